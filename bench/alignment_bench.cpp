@@ -0,0 +1,24 @@
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// Push/pop throughput with hot atomics padded to Cache_Line_Size against packed ones (alignof(void*)).
+
+static const size_t g_max_threads_num = 64;
+
+template<size_t Alignment>
+static void BM_PushPop(benchmark::State& state) {
+    /// benchmark threads of a run must share one queue, so it lives across runs.
+    static msq::Queue<size_t, g_max_threads_num, msq::NodePool, Alignment> queue;
+
+    size_t value = 0;
+    for (auto _: state) {
+        queue.push(value);
+        queue.pop(value);
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 2));
+}
+
+BENCHMARK_TEMPLATE(BM_PushPop, msq::Cache_Line_Size)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PushPop, alignof(void*))->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
@@ -0,0 +1,61 @@
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// Push/pop throughput of Queue with backoff policies of its CAS loops, average retries per successful operation
+/// are taken from the statistic.
+
+static const size_t g_max_threads_num = 64;
+
+template<class Backoff>
+using Queue = msq::Queue<size_t, g_max_threads_num, msq::NodePool, msq::Cache_Line_Size, msq::SharedStats<>,
+        msq::HazardPointerManager, msq::MultiProducerMultiConsumer, Backoff>;
+
+/// Retries are loop iterations of successful operations except the last one of every operation.
+static double GetAverageRetries(const std::array<size_t, msq::Retries_Histogram_Size>& histogram_before,
+                                const std::array<size_t, msq::Retries_Histogram_Size>& histogram_after,
+                                size_t loop_iterations_number) {
+    size_t operations_number = 0;
+    for (size_t i = 0; i < msq::Retries_Histogram_Size; ++i) {
+        operations_number += histogram_after[i] - histogram_before[i];
+    }
+    if (operations_number == 0) {
+        return 0;
+    }
+    return static_cast<double>(loop_iterations_number - operations_number) / static_cast<double>(operations_number);
+}
+
+template<class Backoff>
+static void BM_BackoffPushPop(benchmark::State& state) {
+    /// benchmark threads of a run must share one queue, so it lives across runs.
+    static Queue<Backoff> queue;
+    static msq::Statistic statistic_before;
+
+    if (state.thread_index() == 0) {
+        statistic_before = queue.GetStatistic();
+    }
+
+    size_t value = 0;
+    for (auto _: state) {
+        queue.push(value);
+        queue.pop(value);
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 2));
+
+    /// the first thread reports retries of all threads of the run, others may still be working,
+    /// so it's a close estimate.
+    if (state.thread_index() == 0) {
+        msq::Statistic statistic = queue.GetStatistic();
+        state.counters["push_retries"] = GetAverageRetries(
+                statistic_before.push_retries_histogram, statistic.push_retries_histogram,
+                statistic.loop_iterations_number_in_push - statistic_before.loop_iterations_number_in_push);
+        state.counters["pop_retries"] = GetAverageRetries(
+                statistic_before.pop_retries_histogram, statistic.pop_retries_histogram,
+                statistic.loop_iterations_number_in_pop - statistic_before.loop_iterations_number_in_pop);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_BackoffPushPop, msq::NoBackoff)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BackoffPushPop, msq::ExponentialBackoff<>)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_BackoffPushPop, msq::AdaptiveBackoff<>)->Threads(2)->Threads(8)->Threads(32)->UseRealTime();
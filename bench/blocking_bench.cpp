@@ -0,0 +1,90 @@
+#include <ctime>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// Blocking pop: CPU time burnt by idle consumers and wake-up latency of a parked consumer.
+
+using Clock = std::chrono::steady_clock;
+using Queue = msq::Queue<Clock::rep, msq::Dynamic_Threads_Num>;
+
+static const auto g_idle_duration = std::chrono::milliseconds(100);
+
+static double GetProcessCpuSeconds() {
+    timespec time{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_nsec) / 1e9;
+}
+
+/// consumers wait on an empty queue, cpu_usage is CPU time of the process per wall time.
+template<bool Is_Blocking>
+static void BM_IdleConsumers(benchmark::State& state) {
+    const auto consumers_num = static_cast<size_t>(state.range(0));
+
+    double cpu_usage = 0;
+    for (auto _: state) {
+        Queue queue;
+        std::atomic<bool> stop{false};
+        std::vector<std::thread> consumers;
+
+        double cpu_start = GetProcessCpuSeconds();
+        auto wall_start = Clock::now();
+        for (size_t i = 0; i < consumers_num; ++i) {
+            consumers.emplace_back([&queue, &stop]() {
+                Clock::rep value;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    if (Is_Blocking) {
+                        queue.pop_for(value, std::chrono::milliseconds(10));
+                    }
+                    else if (!queue.pop(value)) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        std::this_thread::sleep_for(g_idle_duration);
+        stop.store(true);
+        for (auto& consumer: consumers) {
+            consumer.join();
+        }
+        std::chrono::duration<double> wall_time = Clock::now() - wall_start;
+        cpu_usage += (GetProcessCpuSeconds() - cpu_start) / wall_time.count();
+    }
+    state.counters["cpu_usage"] = cpu_usage / static_cast<double>(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_IdleConsumers, true)->Arg(1)->Arg(4)->Iterations(5)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_IdleConsumers, false)->Arg(1)->Arg(4)->Iterations(5)->Unit(benchmark::kMillisecond);
+
+/// Time from push to the return of pop_wait in a consumer which has already parked.
+static void BM_WakeUpLatency(benchmark::State& state) {
+    Queue requests;
+    Queue latencies;
+    std::thread consumer([&requests, &latencies]() {
+        Clock::rep push_time;
+        while (true) {
+            requests.pop_wait(push_time);
+            if (push_time == 0) {
+                return;
+            }
+            latencies.push(Clock::now().time_since_epoch().count() - push_time);
+        }
+    });
+
+    for (auto _: state) {
+        /// let the consumer go through spinning and fall asleep.
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        requests.push(Clock::now().time_since_epoch().count());
+
+        Clock::rep latency;
+        latencies.pop_wait(latency);
+        state.SetIterationTime(std::chrono::duration<double>(Clock::duration(latency)).count());
+    }
+
+    requests.push(0);
+    consumer.join();
+}
+
+BENCHMARK(BM_WakeUpLatency)->Iterations(200)->UseManualTime()->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,75 @@
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <unistd.h>
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// Thread churn as in example/main.cpp: every iteration is a wave of threads which push/pop and exit, then
+/// the measuring thread pushes/pops, so retired nodes of finished threads can be reclaimed only by adoption.
+/// Reports unreclaimed nodes at the end and resident memory growth between the first and the last wave.
+
+static const size_t g_wave_threads_num = 16;
+static const size_t g_thread_ops_number = 4096;
+static const int64_t g_waves_number = 64;
+
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+using Queue = msq::Queue<size_t, msq::Dynamic_Threads_Num, msq::NodePool, msq::Cache_Line_Size, msq::SharedStats<>,
+        Reclamation>;
+
+/// Resident set size from /proc/self/statm, 0 if it isn't available.
+static size_t GetResidentKb() {
+    std::ifstream statm("/proc/self/statm");
+    size_t size_pages = 0;
+    size_t resident_pages = 0;
+    if (!(statm >> size_pages >> resident_pages)) {
+        return 0;
+    }
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+static void BM_ThreadChurn(benchmark::State& state) {
+    Queue<Reclamation> queue;
+    size_t first_wave_resident_kb = 0;
+
+    for (auto _: state) {
+        std::vector<std::thread> wave;
+        for (size_t i = 0; i < g_wave_threads_num; ++i) {
+            wave.emplace_back([&queue]() {
+                size_t value = 0;
+                for (size_t j = 0; j < g_thread_ops_number; ++j) {
+                    queue.push(j);
+                    queue.pop(value);
+                }
+            });
+        }
+        for (auto& thread: wave) {
+            thread.join();
+        }
+
+        size_t value = 0;
+        for (size_t j = 0; j < g_thread_ops_number; ++j) {
+            queue.push(j);
+            queue.pop(value);
+        }
+        if (first_wave_resident_kb == 0) {
+            first_wave_resident_kb = GetResidentKb();
+        }
+    }
+
+    msq::Statistic statistic = queue.GetStatistic();
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<int64_t>((g_wave_threads_num + 1) * g_thread_ops_number * 2));
+    state.counters["unreclaimed_nodes"] = static_cast<double>(statistic.constructed_nodes_number -
+                                                              statistic.destructed_nodes_number);
+    state.counters["resident_growth_kb"] = static_cast<double>(GetResidentKb()) -
+                                           static_cast<double>(first_wave_resident_kb);
+}
+
+BENCHMARK_TEMPLATE(BM_ThreadChurn, msq::HazardPointerManager)->Iterations(g_waves_number)
+        ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ThreadChurn, msq::IncrementalHazardPointerManager)->Iterations(g_waves_number)
+        ->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_ThreadChurn, msq::EpochManager)->Iterations(g_waves_number)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,46 @@
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// Queue against EliminationQueue with 50/50 random pushes and pops on a nearly empty queue, where pops find
+/// the queue empty and pushes can meet them in the elimination array.
+
+using Queue = msq::Queue<size_t, msq::Dynamic_Threads_Num>;
+using EliminationQueue = msq::EliminationQueue<Queue>;
+
+template<class QueueType>
+static void BM_MixedPushPop(benchmark::State& state) {
+    /// benchmark threads of a run must share one queue, so it lives across runs.
+    static QueueType queue;
+    static msq::Statistic statistic_before;
+
+    if (state.thread_index() == 0) {
+        statistic_before = queue.GetStatistic();
+    }
+
+    auto random_state = static_cast<uint32_t>(state.thread_index() + 1) * 2654435761u;
+    size_t value = 0;
+    for (auto _: state) {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        if (random_state & 1u) {
+            queue.push(value);
+        }
+        else {
+            queue.pop(value);
+        }
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+
+    if (state.thread_index() == 0) {
+        msq::Statistic statistic = queue.GetStatistic();
+        state.counters["eliminated_pairs"] = static_cast<double>(statistic.eliminated_pairs_number -
+                                                                 statistic_before.eliminated_pairs_number);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_MixedPushPop, Queue)->Threads(2)->Threads(8)->Threads(32)->Threads(64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MixedPushPop, EliminationQueue)->Threads(2)->Threads(8)->Threads(32)->Threads(64)
+        ->UseRealTime();
@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// Control lane latency under bulk load: a bulk producer keeps the lowest priority lane full, a control producer
+/// pushes timestamps to lane 0 and the measuring thread pops. MultiLaneQueue is compared with separate Queue
+/// instances which are polled in priority order, as without it.
+
+static const size_t g_lanes_num = 8;
+static const size_t g_control_lane = 0;
+static const size_t g_bulk_lane = g_lanes_num - 1;
+static const int64_t g_max_bulk_backlog = 4096;
+
+using Clock = std::chrono::steady_clock;
+
+/// 0 is bulk data, a control message is its push time.
+using Message = int64_t;
+
+using MultiLaneQueue = msq::MultiLaneQueue<Message, g_lanes_num, msq::Dynamic_Threads_Num>;
+
+class PolledQueues {
+public:
+    void push(size_t lane, Message message) {
+        _lanes[lane].push(message);
+    }
+
+    bool pop(Message& result) {
+        for (auto& lane: _lanes) {
+            if (lane.pop(result)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::array<msq::Queue<Message, msq::Dynamic_Threads_Num>, g_lanes_num> _lanes;
+};
+
+static int64_t GetNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+/// Reports p50 and p99 latency of control messages from push to pop and the popping rate of the measuring thread.
+template<class QueueType>
+static void BM_ControlLaneLatency(benchmark::State& state) {
+    QueueType queue;
+    std::atomic<bool> stop{false};
+    std::atomic<int64_t> bulk_backlog{0};
+
+    std::thread bulk_producer([&queue, &stop, &bulk_backlog]() {
+        while (!stop.load(std::memory_order_relaxed)) {
+            if (bulk_backlog.load(std::memory_order_relaxed) < g_max_bulk_backlog) {
+                queue.push(g_bulk_lane, 0);
+                bulk_backlog.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    std::thread control_producer([&queue, &stop]() {
+        while (!stop.load(std::memory_order_relaxed)) {
+            queue.push(g_control_lane, GetNowNs());
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+    });
+
+    std::vector<int64_t> latencies;
+    latencies.reserve(1 << 16);
+    Message message = 0;
+    for (auto _: state) {
+        if (!queue.pop(message)) {
+            continue;
+        }
+        if (message == 0) {
+            bulk_backlog.fetch_sub(1, std::memory_order_relaxed);
+        }
+        else {
+            latencies.push_back(GetNowNs() - message);
+        }
+    }
+
+    stop.store(true);
+    bulk_producer.join();
+    control_producer.join();
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+    if (latencies.empty()) {
+        return;
+    }
+    auto p50 = latencies.begin() + static_cast<ptrdiff_t>(0.5 * static_cast<double>(latencies.size() - 1));
+    std::nth_element(latencies.begin(), p50, latencies.end());
+    state.counters["control_p50_ns"] = static_cast<double>(*p50);
+    auto p99 = latencies.begin() + static_cast<ptrdiff_t>(0.99 * static_cast<double>(latencies.size() - 1));
+    std::nth_element(latencies.begin(), p99, latencies.end());
+    state.counters["control_p99_ns"] = static_cast<double>(*p99);
+}
+
+BENCHMARK_TEMPLATE(BM_ControlLaneLatency, MultiLaneQueue)->Iterations(1 << 21)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ControlLaneLatency, PolledQueues)->Iterations(1 << 21)->UseRealTime();
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <boost/lockfree/queue.hpp>
+
+#include "MichaelScottQueue.h"
+
+/// msq::Queue, msq::SegmentedQueue and msq::BoundedQueue against boost::lockfree::queue and a mutex queue with
+/// different numbers of producers and consumers and payload sizes, single consumer specializations of msq::Queue
+/// run only with the loads they support. Every iteration passes the same number of values through a new queue
+/// and reports ops/sec, per-op latency percentiles and heap allocations per op,
+/// run with --benchmark_format=json (or --benchmark_out=<file> --benchmark_out_format=json) to export them.
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t g_values_per_iteration = 1 << 15;
+static const size_t g_boost_initial_nodes_number = 128;
+static const size_t g_bounded_queue_capacity = 1024;
+
+/// allocations are counted per thread, so counting doesn't add contention to the measured queues.
+/// The replacement is global, so this file is built into its own msq-comparison-bench binary.
+static thread_local size_t g_thread_allocations_number = 0;
+
+void* operator new(size_t size) {
+    ++g_thread_allocations_number;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    ++g_thread_allocations_number;
+    auto align = static_cast<size_t>(alignment);
+    if (void* ptr = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+/// gcc inlines these into delete expressions and warns that free is called on a pointer from operator new,
+/// but the replaced operator new above allocates with malloc, so the pair matches.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t /*size*/) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t /*alignment*/) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t /*size*/, std::align_val_t /*alignment*/) noexcept {
+    std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+template<size_t Size>
+struct Payload {
+    static_assert(Size >= sizeof(size_t), "Payload must fit a sequence number");
+
+    size_t sequence_number;
+    std::array<unsigned char, Size - sizeof(size_t)> padding;
+};
+
+template<class T>
+using MsqQueue = msq::Queue<T, msq::Dynamic_Threads_Num>;
+
+template<class T>
+using MsqSpscQueue = msq::SpscQueue<T>;
+
+template<class T>
+using MsqMpscQueue = msq::MpscQueue<T>;
+
+template<class T>
+using MsqSegmentedQueue = msq::SegmentedQueue<T, msq::Dynamic_Threads_Num>;
+
+/// producers block in push when the ring is full, so it's measured with backpressure.
+template<class T>
+using MsqBoundedQueue = msq::BoundedQueue<T, g_bounded_queue_capacity>;
+
+template<class T>
+class BoostQueue : public boost::lockfree::queue<T> {
+public:
+    BoostQueue() : boost::lockfree::queue<T>(g_boost_initial_nodes_number) {}
+};
+
+template<class T>
+class MutexQueue {
+public:
+    void push(const T& value) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _queue.push(value);
+    }
+
+    bool pop(T& result) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_queue.empty()) {
+            return false;
+        }
+        result = _queue.front();
+        _queue.pop();
+        return true;
+    }
+
+private:
+    std::mutex _mutex;
+    std::queue<T> _queue;
+};
+
+static uint64_t GetPercentile(std::vector<uint64_t>& latencies, double percentile) {
+    auto nth = latencies.begin() + static_cast<ptrdiff_t>(percentile * static_cast<double>(latencies.size() - 1));
+    std::nth_element(latencies.begin(), nth, latencies.end());
+    return *nth;
+}
+
+/// state.range(0) producers push and state.range(1) consumers pop equal shares of the values.
+/// Latency is measured for every push and every successful pop, percentiles are averaged over iterations.
+template<template<class> class QueueType, size_t Payload_Size>
+static void BM_ProducersConsumers(benchmark::State& state) {
+    using Value = Payload<Payload_Size>;
+
+    const auto producers_num = static_cast<size_t>(state.range(0));
+    const auto consumers_num = static_cast<size_t>(state.range(1));
+    const size_t threads_num = producers_num + consumers_num;
+    const size_t values_number = g_values_per_iteration / (producers_num * consumers_num) * producers_num *
+                                 consumers_num;
+
+    double p50_sum = 0;
+    double p99_sum = 0;
+    double p999_sum = 0;
+    size_t allocations_number = 0;
+
+    for (auto _: state) {
+        QueueType<Value> queue;
+        std::vector<std::vector<uint64_t>> thread_latencies(threads_num);
+        std::vector<size_t> thread_allocations(threads_num, 0);
+        std::atomic<size_t> ready{0};
+        std::atomic<bool> start{false};
+
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < threads_num; ++t) {
+            threads.emplace_back([&, t]() {
+                const bool is_producer = t < producers_num;
+                const size_t ops_number = values_number / (is_producer ? producers_num : consumers_num);
+                std::vector<uint64_t>& latencies = thread_latencies[t];
+                latencies.reserve(ops_number);
+
+                ready.fetch_add(1);
+                while (!start.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+
+                size_t allocations_before = g_thread_allocations_number;
+                Value value{};
+                for (size_t i = 0; i < ops_number; ++i) {
+                    if (is_producer) {
+                        value.sequence_number = i;
+                        auto op_start = Clock::now();
+                        queue.push(value);
+                        latencies.push_back(static_cast<uint64_t>((Clock::now() - op_start).count()));
+                        continue;
+                    }
+                    while (true) {
+                        auto op_start = Clock::now();
+                        if (queue.pop(value)) {
+                            latencies.push_back(static_cast<uint64_t>((Clock::now() - op_start).count()));
+                            break;
+                        }
+                        std::this_thread::yield();
+                    }
+                    benchmark::DoNotOptimize(value);
+                }
+                /// latencies were reserved, so only the queue allocates here.
+                thread_allocations[t] = g_thread_allocations_number - allocations_before;
+            });
+        }
+        while (ready.load() < threads_num) {
+            std::this_thread::yield();
+        }
+
+        auto iteration_start = Clock::now();
+        start.store(true, std::memory_order_release);
+        for (auto& thread: threads) {
+            thread.join();
+        }
+        state.SetIterationTime(std::chrono::duration<double>(Clock::now() - iteration_start).count());
+
+        std::vector<uint64_t> latencies;
+        latencies.reserve(values_number * 2);
+        for (size_t t = 0; t < threads_num; ++t) {
+            latencies.insert(latencies.end(), thread_latencies[t].begin(), thread_latencies[t].end());
+            allocations_number += thread_allocations[t];
+        }
+        p50_sum += static_cast<double>(GetPercentile(latencies, 0.5));
+        p99_sum += static_cast<double>(GetPercentile(latencies, 0.99));
+        p999_sum += static_cast<double>(GetPercentile(latencies, 0.999));
+    }
+
+    auto iterations = static_cast<double>(state.iterations());
+    auto ops_number = static_cast<double>(state.iterations() * values_number * 2);
+    state.SetItemsProcessed(static_cast<int64_t>(ops_number));
+    state.counters["p50_ns"] = p50_sum / iterations;
+    state.counters["p99_ns"] = p99_sum / iterations;
+    state.counters["p999_ns"] = p999_sum / iterations;
+    state.counters["allocs_per_op"] = static_cast<double>(allocations_number) / ops_number;
+}
+
+/// {producers, consumers}: balanced loads of growing size and both skewed ratios.
+static void SetArguments(benchmark::internal::Benchmark* benchmark) {
+    benchmark->Args({1, 1})->Args({2, 2})->Args({4, 4})->Args({16, 16})->Args({1, 4})->Args({4, 1});
+    benchmark->ArgNames({"producers", "consumers"})->UseManualTime()->Unit(benchmark::kMillisecond);
+}
+
+static void SetSingleConsumerArguments(benchmark::internal::Benchmark* benchmark) {
+    benchmark->Args({1, 1})->Args({4, 1})->Args({16, 1});
+    benchmark->ArgNames({"producers", "consumers"})->UseManualTime()->Unit(benchmark::kMillisecond);
+}
+
+static void SetSingleProducerSingleConsumerArguments(benchmark::internal::Benchmark* benchmark) {
+    benchmark->Args({1, 1});
+    benchmark->ArgNames({"producers", "consumers"})->UseManualTime()->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqQueue, 8)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqQueue, 64)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqQueue, 256)->Apply(SetArguments);
+/// {16, 1} for comparison with MPSC, other single consumer loads are in SetArguments.
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqQueue, 8)->Args({16, 1})->ArgNames({"producers", "consumers"})
+        ->UseManualTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqSpscQueue, 8)->Apply(SetSingleProducerSingleConsumerArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqSpscQueue, 64)->Apply(SetSingleProducerSingleConsumerArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqSpscQueue, 256)->Apply(SetSingleProducerSingleConsumerArguments);
+
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqMpscQueue, 8)->Apply(SetSingleConsumerArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqMpscQueue, 64)->Apply(SetSingleConsumerArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqMpscQueue, 256)->Apply(SetSingleConsumerArguments);
+
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqSegmentedQueue, 8)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqSegmentedQueue, 64)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqSegmentedQueue, 256)->Apply(SetArguments);
+
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqBoundedQueue, 8)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqBoundedQueue, 64)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MsqBoundedQueue, 256)->Apply(SetArguments);
+
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, BoostQueue, 8)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, BoostQueue, 64)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, BoostQueue, 256)->Apply(SetArguments);
+
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MutexQueue, 8)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MutexQueue, 64)->Apply(SetArguments);
+BENCHMARK_TEMPLATE(BM_ProducersConsumers, MutexQueue, 256)->Apply(SetArguments);
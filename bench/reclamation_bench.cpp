@@ -0,0 +1,88 @@
+#include <vector>
+#include <thread>
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// Scan cost of HazardPointerManager reclamation against the number of threads which hold hazard pointers.
+
+static const size_t g_max_threads_num = 64;
+static const size_t g_hazard_pointers_num = 3;
+
+struct DummyNode {
+    size_t value;
+};
+
+/// Retired pointers point to a static array, so clearing measures only scan and lookup, not the heap.
+class NoopAllocator {
+public:
+    class LocalCache {
+    };
+
+    void Delete(LocalCache& /*cache*/, DummyNode* /*node*/) {}
+
+    void Flush(LocalCache& /*cache*/) {}
+};
+
+using Manager = msq::HazardPointerManager<DummyNode*, g_hazard_pointers_num, g_max_threads_num, NoopAllocator,
+        msq::NoStats>;
+using HazardPtr = msq::HazardPointer<Manager>;
+
+static const size_t g_retired_ptrs_num = g_hazard_pointers_num * g_max_threads_num;
+static DummyNode g_nodes[g_retired_ptrs_num * 2];
+
+/// the manager is shared by the holder threads and the measuring thread of all runs.
+static Manager& GetManager() {
+    static NoopAllocator allocator;
+    static msq::NoStats stats;
+    static Manager manager(allocator, stats);
+    return manager;
+}
+
+static void BM_ClearRetiredPointers(benchmark::State& state) {
+    Manager& manager = GetManager();
+    const auto holders_num = static_cast<size_t>(state.range(0));
+
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> ready{0};
+    std::vector<std::thread> holders;
+
+    /// every holder protects all its hazard pointers, half of them point to retired nodes.
+    for (size_t t = 0; t < holders_num; ++t) {
+        holders.emplace_back([&manager, &stop, &ready, t]() {
+            std::vector<std::atomic<DummyNode*>> sources(g_hazard_pointers_num);
+            std::vector<HazardPtr> hazard_pointers;
+            hazard_pointers.reserve(g_hazard_pointers_num);
+            for (size_t i = 0; i < g_hazard_pointers_num; ++i) {
+                sources[i].store(&g_nodes[(t * g_hazard_pointers_num + i) * 2]);
+                hazard_pointers.emplace_back(&manager);
+                hazard_pointers.back().Protect(sources[i]);
+            }
+            ready.fetch_add(1);
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::this_thread::yield();
+            }
+        });
+    }
+    while (ready.load() < holders_num) {
+        std::this_thread::yield();
+    }
+
+    Manager::DataTLS* tls = manager.GetTLS();
+    for (auto _: state) {
+        for (size_t i = 0; i < g_retired_ptrs_num; ++i) {
+            tls->TryAddRetiredPtr(&g_nodes[i]);
+        }
+        tls->ClearRetiredPointers();
+        tls->ForceClearRetiredPointers();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * g_retired_ptrs_num));
+    state.counters["hazard_pointers"] = static_cast<double>(holders_num * g_hazard_pointers_num);
+
+    stop.store(true);
+    for (auto& holder: holders) {
+        holder.join();
+    }
+}
+
+BENCHMARK(BM_ClearRetiredPointers)->RangeMultiplier(2)->Range(1, 32)->UseRealTime();
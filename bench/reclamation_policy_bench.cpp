@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// HazardPointerManager, IncrementalHazardPointerManager and EpochManager as the Reclamation policy of Queue:
+/// push/pop throughput with and without Queue::Handle, reclamation pauses and the peak number of unreclaimed nodes
+/// while another thread stalls inside pop.
+
+static const size_t g_max_threads_num = 64;
+static const size_t g_stall_ops_number = 1 << 16;
+static const size_t g_sample_period = 256;
+static const size_t g_holder_threads_num = 32;
+
+template<class T, template<class, size_t, size_t, class, class, size_t> class Reclamation>
+using Queue = msq::Queue<T, g_max_threads_num, msq::NodePool, msq::Cache_Line_Size, msq::SharedStats<>,
+        Reclamation>;
+
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+static void BM_ReclamationPushPop(benchmark::State& state) {
+    /// benchmark threads of a run must share one queue, so it lives across runs.
+    static Queue<size_t, Reclamation> queue;
+
+    size_t value = 0;
+    for (auto _: state) {
+        queue.push(value);
+        queue.pop(value);
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 2));
+}
+
+BENCHMARK_TEMPLATE(BM_ReclamationPushPop, msq::HazardPointerManager)->Threads(1)->Threads(2)->Threads(8)
+        ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ReclamationPushPop, msq::EpochManager)->Threads(1)->Threads(2)->Threads(8)->UseRealTime();
+
+/// Same as BM_ReclamationPushPop through Queue::Handle, which takes TLS and hazard pointers once per thread.
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+static void BM_HandlePushPop(benchmark::State& state) {
+    static Queue<size_t, Reclamation> queue;
+    auto handle = queue.GetHandle();
+
+    size_t value = 0;
+    for (auto _: state) {
+        handle.push(value);
+        handle.pop(value);
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 2));
+}
+
+BENCHMARK_TEMPLATE(BM_HandlePushPop, msq::HazardPointerManager)->Threads(1)->Threads(2)->Threads(8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_HandlePushPop, msq::EpochManager)->Threads(1)->Threads(2)->Threads(8)->UseRealTime();
+
+/// g_holder_threads_num threads keep handles of the queue, so every clearing scans their hazard pointers.
+/// Reports p999 latency of push+pop pairs of the measuring thread and the longest reclamation pause.
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+static void BM_ReclamationPause(benchmark::State& state) {
+    using Clock = std::chrono::steady_clock;
+
+    Queue<size_t, Reclamation> queue;
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> ready{0};
+    std::vector<std::thread> holders;
+    for (size_t i = 0; i < g_holder_threads_num; ++i) {
+        holders.emplace_back([&queue, &stop, &ready]() {
+            auto handle = queue.GetHandle();
+            size_t value = 0;
+            handle.push(value);
+            handle.pop(value);
+            ready.fetch_add(1);
+            while (!stop.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+    while (ready.load() != g_holder_threads_num) {
+        std::this_thread::yield();
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(1 << 20);
+    size_t value = 0;
+    for (auto _: state) {
+        auto op_start = Clock::now();
+        queue.push(value);
+        queue.pop(value);
+        latencies.push_back(static_cast<uint64_t>((Clock::now() - op_start).count()));
+        benchmark::DoNotOptimize(value);
+    }
+
+    stop.store(true);
+    for (auto& holder: holders) {
+        holder.join();
+    }
+
+    auto p999 = latencies.begin() + static_cast<ptrdiff_t>(0.999 * static_cast<double>(latencies.size() - 1));
+    std::nth_element(latencies.begin(), p999, latencies.end());
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 2));
+    state.counters["p999_ns"] = static_cast<double>(*p999);
+    state.counters["max_reclamation_pause_ns"] = static_cast<double>(queue.GetStatistic().max_reclamation_pause_ns);
+}
+
+BENCHMARK_TEMPLATE(BM_ReclamationPause, msq::HazardPointerManager)->Iterations(1 << 20);
+BENCHMARK_TEMPLATE(BM_ReclamationPause, msq::IncrementalHazardPointerManager)->Iterations(1 << 20);
+BENCHMARK_TEMPLATE(BM_ReclamationPause, msq::EpochManager)->Iterations(1 << 20);
+
+static std::atomic<bool> g_is_stall_released{false};
+static std::atomic<bool> g_is_stalled{false};
+
+/// Pop moves the value out while the node is protected, so moving a stalling value blocks the popping thread
+/// with its hazard pointers or announced epoch until the stall is released.
+class StallingValue {
+public:
+    explicit StallingValue(bool is_stalling = false) : _is_stalling(is_stalling) {}
+
+    StallingValue(StallingValue&& other) noexcept = default;
+
+    StallingValue& operator=(StallingValue&& other) noexcept {
+        if (other._is_stalling) {
+            g_is_stalled.store(true);
+            while (!g_is_stall_released.load()) {
+                std::this_thread::yield();
+            }
+        }
+        _is_stalling = other._is_stalling;
+        return *this;
+    }
+
+private:
+    bool _is_stalling;
+};
+
+/// One thread stalls inside pop, the measuring thread pushes and pops, peak_unreclaimed_nodes is the maximum of
+/// constructed minus destructed nodes.
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+static void BM_StalledThread(benchmark::State& state) {
+    size_t peak_unreclaimed_nodes_number = 0;
+
+    for (auto _: state) {
+        state.PauseTiming();
+        auto* queue = new Queue<StallingValue, Reclamation>;
+        g_is_stall_released.store(false);
+        g_is_stalled.store(false);
+        queue->push(StallingValue(true));
+        std::thread stalled_thread([queue]() {
+            StallingValue value;
+            queue->pop(value);
+        });
+        while (!g_is_stalled.load()) {
+            std::this_thread::yield();
+        }
+        state.ResumeTiming();
+
+        StallingValue value;
+        for (size_t i = 0; i < g_stall_ops_number; ++i) {
+            queue->push(StallingValue());
+            queue->pop(value);
+            if (i % g_sample_period == 0) {
+                auto statistic = queue->GetStatistic();
+                peak_unreclaimed_nodes_number = std::max(peak_unreclaimed_nodes_number,
+                                                         statistic.constructed_nodes_number -
+                                                         statistic.destructed_nodes_number);
+            }
+        }
+
+        state.PauseTiming();
+        g_is_stall_released.store(true);
+        stalled_thread.join();
+        delete queue;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * g_stall_ops_number * 2));
+    state.counters["peak_unreclaimed_nodes"] = static_cast<double>(peak_unreclaimed_nodes_number);
+}
+
+BENCHMARK_TEMPLATE(BM_StalledThread, msq::HazardPointerManager)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_StalledThread, msq::EpochManager)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,40 @@
+#include <benchmark/benchmark.h>
+
+#include "MichaelScottQueue.h"
+
+/// Shards number sweep of ShardedQueue: every thread pushes and pops on its home shard, which is
+/// thread_index % shards, as workers pinned to NUMA nodes do, and steals only when the home shard is empty.
+
+using Queue = msq::Queue<size_t, msq::Dynamic_Threads_Num>;
+using ShardedQueue = msq::ShardedQueue<Queue>;
+
+template<size_t Shards_Num>
+static void BM_ShardedPushPop(benchmark::State& state) {
+    /// benchmark threads of a run must share one queue, so it lives across runs.
+    static ShardedQueue queue(Shards_Num);
+    static msq::Statistic statistic_before;
+
+    if (state.thread_index() == 0) {
+        statistic_before = queue.GetStatistic();
+    }
+
+    const auto home_shard = static_cast<size_t>(state.thread_index());
+    size_t value = 0;
+    for (auto _: state) {
+        queue.push_to(home_shard, value);
+        queue.pop_from(home_shard, value);
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * 2);
+
+    if (state.thread_index() == 0) {
+        msq::Statistic statistic = queue.GetStatistic();
+        state.counters["stolen_pops"] = static_cast<double>(statistic.stolen_pops_number -
+                                                            statistic_before.stolen_pops_number);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_ShardedPushPop, 1)->Threads(8)->Threads(32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ShardedPushPop, 2)->Threads(8)->Threads(32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ShardedPushPop, 4)->Threads(8)->Threads(32)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ShardedPushPop, 8)->Threads(8)->Threads(32)->UseRealTime();
@@ -0,0 +1,101 @@
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "MichaelScottQueue.h"
+
+/// Checks the blocking pops: pop_for of the empty queue returns false after its timeout, a consumer sleeping
+/// in pop_wait or pop_for on the empty queue is woken up by push and gets the pushed value.
+/// The consumer is one thread at a time, so it runs for the single consumer queues too.
+
+using Clock = std::chrono::steady_clock;
+
+static const auto g_timeout = std::chrono::milliseconds(50);
+/// the consumer spins for a few iterations before it sleeps, so it's asleep long before this time is over.
+static const auto g_sleep_time = std::chrono::milliseconds(200);
+/// pop_for which is woken up by push must return long before this timeout.
+static const auto g_long_timeout = std::chrono::seconds(30);
+
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+using BlockingQueue = msq::Queue<uint64_t, msq::Dynamic_Threads_Num, msq::NodePool, msq::Cache_Line_Size,
+        msq::SharedStats<>, Reclamation>;
+
+/// get_popper(queue) returns the queue itself or a Handle of the calling thread, which pops.
+template<class QueueType, class GetPopper>
+bool run_test(const char* name, GetPopper get_popper) {
+    bool is_passed = true;
+    auto check = [&is_passed, name](bool condition, const char* what) {
+        if (!condition) {
+            std::cout << "FAILED " << name << ": " << what << std::endl;
+            is_passed = false;
+        }
+    };
+
+    QueueType queue;
+    {
+        decltype(auto) popper = get_popper(queue);
+        uint64_t value = 0;
+        auto start = Clock::now();
+        check(!popper.pop_for(value, g_timeout), "pop_for of the empty queue returns true");
+        check(Clock::now() - start >= g_timeout, "pop_for returns before its timeout");
+    }
+
+    std::atomic<bool> is_popped{false};
+    uint64_t popped_value = 0;
+    std::thread waiter([&queue, &get_popper, &is_popped, &popped_value]() {
+        decltype(auto) popper = get_popper(queue);
+        popper.pop_wait(popped_value);
+        is_popped.store(true);
+    });
+    std::this_thread::sleep_for(g_sleep_time);
+    check(!is_popped.load(), "pop_wait returns on the empty queue");
+    queue.push(1);
+    waiter.join();
+    check(popped_value == 1, "pop_wait is not woken up by push");
+
+    bool is_timed_popped = false;
+    Clock::duration timed_wait_time{};
+    std::thread timed_waiter([&queue, &get_popper, &is_timed_popped, &popped_value, &timed_wait_time]() {
+        decltype(auto) popper = get_popper(queue);
+        auto start = Clock::now();
+        is_timed_popped = popper.pop_for(popped_value, g_long_timeout);
+        timed_wait_time = Clock::now() - start;
+    });
+    std::this_thread::sleep_for(g_sleep_time);
+    queue.push(2);
+    timed_waiter.join();
+    check(is_timed_popped && popped_value == 2, "pop_for is not woken up by push");
+    check(timed_wait_time < g_long_timeout, "pop_for is woken up by its timeout instead of push");
+    check(queue.empty(), "queue is not empty");
+
+    if (is_passed) {
+        std::cout << "OK     " << name << std::endl;
+    }
+    return is_passed;
+}
+
+template<class QueueType>
+bool run_test(const char* name) {
+    return run_test<QueueType>(name, [](QueueType& queue) -> QueueType& {
+        return queue;
+    });
+}
+
+template<class QueueType>
+bool run_handle_test(const char* name) {
+    return run_test<QueueType>(name, [](QueueType& queue) {
+        return queue.GetHandle();
+    });
+}
+
+int main() {
+    bool is_passed = true;
+    is_passed &= run_test<BlockingQueue<msq::HazardPointerManager>>("hazard pointers");
+    is_passed &= run_handle_test<BlockingQueue<msq::HazardPointerManager>>("hazard pointers, handles");
+    is_passed &= run_test<BlockingQueue<msq::EpochManager>>("epochs");
+    is_passed &= run_test<msq::SpscQueue<uint64_t>>("single producer single consumer");
+    is_passed &= run_test<msq::MpscQueue<uint64_t>>("multi producer single consumer");
+    is_passed &= run_test<msq::BoundedQueue<uint64_t, 16>>("bounded");
+    return is_passed ? 0 : 1;
+}
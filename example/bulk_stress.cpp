@@ -0,0 +1,115 @@
+#include <vector>
+#include <iterator>
+
+#include "MichaelScottQueue.h"
+#include "stress.h"
+
+/// Stress test of push_range and pop_bulk: producers push batches of variable size, consumers pop batches
+/// of variable size, stress.h checks FIFO order of every producer and the total count and sum.
+/// It runs for every reclamation policy, through the queue and through Queue::Handle.
+
+static const size_t g_max_batch_size = 64;
+
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+using StressQueue = msq::Queue<uint64_t, msq::Dynamic_Threads_Num, msq::NodePool, msq::Cache_Line_Size,
+        msq::SharedStats<>, Reclamation>;
+
+static size_t get_batch_size(uint32_t& random_state) {
+    /// xorshift32
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state % g_max_batch_size + 1;
+}
+
+template<class Pusher>
+void producer_routine(Pusher& pusher, uint64_t producer_id, const stress::Config& config) {
+    uint32_t random_state = static_cast<uint32_t>(producer_id + 1) * 2654435761u;
+    std::vector<uint64_t> batch;
+
+    uint64_t sequence = 0;
+    while (sequence < config.values_per_producer) {
+        size_t batch_size = std::min<uint64_t>(get_batch_size(random_state), config.values_per_producer - sequence);
+        batch.clear();
+        for (size_t i = 0; i < batch_size; ++i) {
+            batch.push_back(stress::make_value(producer_id, sequence++));
+        }
+        pusher.push_range(batch.begin(), batch.end());
+    }
+}
+
+template<class Popper>
+void consumer_routine(Popper& popper, uint64_t consumer_id, stress::Totals& totals) {
+    uint32_t random_state = static_cast<uint32_t>(consumer_id + 101) * 2654435761u;
+    stress::consume(totals, [&popper, &random_state](std::vector<uint64_t>& values) {
+        return popper.pop_bulk(std::back_inserter(values), get_batch_size(random_state));
+    });
+}
+
+/// Pushes and pops through the queue itself.
+template<class QueueType>
+class QueueAccess {
+public:
+    explicit QueueAccess(QueueType& queue) : _queue(queue) {}
+
+    template<class It>
+    void push_range(It first, It last) {
+        _queue.push_range(first, last);
+    }
+
+    template<class OutIt>
+    size_t pop_bulk(OutIt out, size_t max_number) {
+        return _queue.pop_bulk(out, max_number);
+    }
+
+private:
+    QueueType& _queue;
+};
+
+/// Pushes and pops through a Handle of the calling thread.
+template<class QueueType>
+class HandleAccess {
+public:
+    explicit HandleAccess(QueueType& queue) : _handle(queue.GetHandle()) {}
+
+    template<class It>
+    void push_range(It first, It last) {
+        _handle.push_range(first, last);
+    }
+
+    template<class OutIt>
+    size_t pop_bulk(OutIt out, size_t max_number) {
+        return _handle.pop_bulk(out, max_number);
+    }
+
+private:
+    typename QueueType::Handle _handle;
+};
+
+template<class QueueType, template<class> class Access>
+bool run_stress(const char* name) {
+    QueueType queue;
+    stress::Config config;
+    return stress::run(name, config, [&queue, &config](uint64_t producer_id) {
+        Access<QueueType> access(queue);
+        producer_routine(access, producer_id, config);
+    }, [&queue](uint64_t consumer_id, stress::Totals& totals) {
+        Access<QueueType> access(queue);
+        consumer_routine(access, consumer_id, totals);
+    }, [&queue]() {
+        return queue.empty();
+    });
+}
+
+int main() {
+    bool is_passed = true;
+    is_passed &= run_stress<StressQueue<msq::HazardPointerManager>, QueueAccess>("hazard pointers");
+    is_passed &= run_stress<StressQueue<msq::HazardPointerManager>, HandleAccess>("hazard pointers, handles");
+    is_passed &= run_stress<StressQueue<msq::IncrementalHazardPointerManager>, QueueAccess>(
+            "incremental hazard pointers");
+    is_passed &= run_stress<StressQueue<msq::IncrementalHazardPointerManager>, HandleAccess>(
+            "incremental hazard pointers, handles");
+    is_passed &= run_stress<StressQueue<msq::EpochManager>, QueueAccess>("epochs");
+    is_passed &= run_stress<StressQueue<msq::EpochManager>, HandleAccess>("epochs, handles");
+    return is_passed ? 0 : 1;
+}
@@ -1,16 +1,25 @@
 #include <vector>
 #include <thread>
 #include <future>
+#ifdef MSQ_TRACE
+#include <fstream>
+#endif
 #include <boost/lockfree/queue.hpp>
 
 #include "MichaelScottQueue.h"
 
+/// sanitizer builds are much slower and keep state of every finished thread, so they run a smaller example.
+#ifdef MSQ_EXAMPLE_ITERATIONS_NUM
+static const int g_iterations_num = MSQ_EXAMPLE_ITERATIONS_NUM;
+#else
 static const int g_iterations_num = 99999;
+#endif
 static const int g_consumer_iterations_before_die = 500;
 static const int g_producer_number = 20;
 static const int g_consumer_number = 10;
 
-using MSQueue = msq::Queue<size_t, g_producer_number + g_consumer_number>;
+/// consumers are respawned, so the number of threads which use the queue at the same time isn't fixed.
+using MSQueue = msq::Queue<size_t, msq::Dynamic_Threads_Num>;
 static std::atomic<size_t> g_final_sum{0};
 static std::atomic<size_t> g_boost_final_sum{0};
 
@@ -96,6 +105,9 @@ int main() {
             consumer_threads.emplace_back(consumer_routine, &sync);
             sync.current_consumers_num.fetch_add(1, std::memory_order_release);
         }
+#ifdef MSQ_TRACE
+        msq::Tracer::Collect();
+#endif
     }
 
     for (auto& thread: producer_threads) {
@@ -118,19 +130,30 @@ int main() {
     msq::MSQ_LOG_DEBUG("boost final value:  ", g_boost_final_sum.load());
     msq::MSQ_LOG_DEBUG("final value:        ", g_final_sum.load());
 
-    auto& statistic = sync.queue.GetStatistic();
+    auto statistic = sync.queue.GetStatistic();
     msq::MSQ_LOG_DEBUG("\nstatistic:",
-          "\nsuccessful push number: ", statistic.successful_push_number.load(),
-          "\nsuccessful pop number: ", statistic.successful_pop_number.load(),
-          "\nempty pop number: ", statistic.empty_pop_number.load(),
-          "\nclearing function call number: ", statistic.clearing_function_call_number.load(),
-          "\nloop g_iterations_num in successful push: ", statistic.loop_iterations_number_in_push.load(),
+          "\nsuccessful push number: ", statistic.successful_push_number,
+          "\nsuccessful pop number: ", statistic.successful_pop_number,
+          "\nempty pop number: ", statistic.empty_pop_number,
+          "\nclearing function call number: ", statistic.clearing_function_call_number,
+          "\nloop g_iterations_num in successful push: ", statistic.loop_iterations_number_in_push,
           "\naverage loop g_iterations_num in successful push: ",
-          (double) statistic.loop_iterations_number_in_push.load() / (double) statistic.successful_push_number.load(),
-          "\nloop g_iterations_num in successful pop: ", statistic.loop_iterations_number_in_pop.load(),
+          (double) statistic.loop_iterations_number_in_push / (double) statistic.successful_push_number,
+          "\nloop g_iterations_num in successful pop: ", statistic.loop_iterations_number_in_pop,
           "\naverage loop g_iterations_num in successful pop: ",
-          (double) statistic.loop_iterations_number_in_pop.load() / (double) statistic.successful_pop_number.load(),
-          "\nconstructed nodes number: ", statistic.constructed_nodes_number.load(),
-          "\ndestructed nodes number: ", statistic.destructed_nodes_number.load());
+          (double) statistic.loop_iterations_number_in_pop / (double) statistic.successful_pop_number,
+          "\nconstructed nodes number: ", statistic.constructed_nodes_number,
+          "\ndestructed nodes number: ", statistic.destructed_nodes_number,
+          "\npool hit number: ", statistic.pool_hit_number,
+          "\npool miss number: ", statistic.pool_miss_number,
+          "\nmax reclamation pause ns: ", statistic.max_reclamation_pause_ns);
+    msq::MSQ_LOG_DEBUG("\nretries histogram (bucket: push, pop), bucket i > 0 is [2^(i-1), 2^i) retries:");
+    for (size_t i = 0; i < msq::Retries_Histogram_Size; ++i) {
+        msq::MSQ_LOG_DEBUG(i, ": ", statistic.push_retries_histogram[i], ", ", statistic.pop_retries_histogram[i]);
+    }
+#ifdef MSQ_TRACE
+    std::ofstream trace("msq_trace.csv");
+    msq::Tracer::Export(trace);
+#endif
     return 0;
 }
@@ -0,0 +1,166 @@
+#include <vector>
+#include <optional>
+#include <thread>
+#include <iostream>
+#include <stdexcept>
+
+#include "MichaelScottQueue.h"
+#include "stress.h"
+
+/// Stress test of single push and pop for the sanitizer runs: producers push values one by one, consumers take them
+/// with pop and try_pop in turn, stress.h checks FIFO order of every producer and the total count and sum.
+/// It runs for every reclamation policy, through the queue and through Queue::Handle, with Dynamic_Threads_Num
+/// and with a fixed Max_Threads_Num (FixedRetiredList and the stack HazardPointersSnapshot).
+/// check_threads_limit checks that the fixed hazard pointer managers throw std::logic_error
+/// when more threads than Max_Threads_Num hold hazard pointers.
+/// ctest runs it twice: mpmc_stress with the membarrier fence of the hazard pointers and mpmc_stress_fence
+/// built with -D MSQ_NO_MEMBARRIER, which takes the seq_cst fence path.
+
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation,
+        size_t Max_Threads_Num = msq::Dynamic_Threads_Num>
+using StressQueue = msq::Queue<uint64_t, Max_Threads_Num, msq::NodePool, msq::Cache_Line_Size,
+        msq::SharedStats<>, Reclamation>;
+
+/// the producers and consumers of the default stress::Config, the main thread uses the queue after they are joined.
+static const size_t g_fixed_threads_num = 8;
+
+/// Handle of the calling thread, or the queue itself.
+template<class QueueType, bool Is_Handle>
+class Access {
+public:
+    explicit Access(QueueType& queue) : _queue(queue) {
+        if constexpr (Is_Handle) {
+            _handle.emplace(queue);
+        }
+    }
+
+    void push(uint64_t value) {
+        if constexpr (Is_Handle) {
+            _handle->push(value);
+        }
+        else {
+            _queue.push(value);
+        }
+    }
+
+    bool pop(uint64_t& result) {
+        if constexpr (Is_Handle) {
+            return _handle->pop(result);
+        }
+        else {
+            return _queue.pop(result);
+        }
+    }
+
+    std::optional<uint64_t> try_pop() {
+        if constexpr (Is_Handle) {
+            return _handle->try_pop();
+        }
+        else {
+            return _queue.try_pop();
+        }
+    }
+
+private:
+    QueueType& _queue;
+    std::optional<typename QueueType::Handle> _handle;
+};
+
+template<class QueueType, bool Is_Handle>
+bool run_stress(const char* name) {
+    QueueType queue;
+    stress::Config config;
+    return stress::run(name, config, [&queue, &config](uint64_t producer_id) {
+        Access<QueueType, Is_Handle> access(queue);
+        for (uint64_t sequence = 0; sequence < config.values_per_producer; ++sequence) {
+            access.push(stress::make_value(producer_id, sequence));
+        }
+    }, [&queue](uint64_t, stress::Totals& totals) {
+        Access<QueueType, Is_Handle> access(queue);
+        bool is_try_pop = false;
+        stress::consume(totals, [&access, &is_try_pop](std::vector<uint64_t>& values) {
+            is_try_pop = !is_try_pop;
+            if (is_try_pop) {
+                std::optional<uint64_t> result = access.try_pop();
+                if (result) {
+                    values.push_back(*result);
+                }
+            }
+            else {
+                uint64_t value;
+                if (access.pop(value)) {
+                    values.push_back(value);
+                }
+            }
+            return values.size();
+        });
+    }, [&queue]() {
+        return queue.empty();
+    });
+}
+
+/// Two threads hold handles, which keep all hazard pointers of Max_Threads_Num == 1 allocated, so clearing
+/// of the retired pointers in the main thread has no space for the hazard pointers snapshot.
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+bool check_threads_limit(const char* name) {
+    using QueueType = StressQueue<Reclamation, 1>;
+    QueueType queue;
+    std::atomic<size_t> holders_number{0};
+    std::atomic<bool> is_done{false};
+
+    std::vector<std::thread> holders;
+    for (int i = 0; i < 2; ++i) {
+        holders.emplace_back([&queue, &holders_number, &is_done]() {
+            typename QueueType::Handle handle(queue);
+            holders_number.fetch_add(1);
+            while (!is_done.load()) {
+                std::this_thread::yield();
+            }
+        });
+    }
+    while (holders_number.load() != holders.size()) {
+        std::this_thread::yield();
+    }
+
+    bool is_thrown = false;
+    try {
+        for (uint64_t i = 0; i < 1000; ++i) {
+            queue.push(i);
+            uint64_t value;
+            queue.pop(value);
+        }
+    }
+    catch (const std::logic_error&) {
+        is_thrown = true;
+    }
+    is_done.store(true);
+    for (auto& holder: holders) {
+        holder.join();
+    }
+
+    std::cout << (is_thrown ? "OK     " : "FAILED ") << name << ": "
+              << (is_thrown ? "" : "no ") << "logic_error when the threads limit is exceeded" << std::endl;
+    return is_thrown;
+}
+
+int main() {
+    bool is_passed = true;
+    is_passed &= run_stress<StressQueue<msq::HazardPointerManager>, false>("hazard pointers");
+    is_passed &= run_stress<StressQueue<msq::HazardPointerManager>, true>("hazard pointers, handles");
+    is_passed &= run_stress<StressQueue<msq::IncrementalHazardPointerManager>, false>(
+            "incremental hazard pointers");
+    is_passed &= run_stress<StressQueue<msq::IncrementalHazardPointerManager>, true>(
+            "incremental hazard pointers, handles");
+    is_passed &= run_stress<StressQueue<msq::EpochManager>, false>("epochs");
+    is_passed &= run_stress<StressQueue<msq::EpochManager>, true>("epochs, handles");
+    is_passed &= run_stress<StressQueue<msq::HazardPointerManager, g_fixed_threads_num>, false>(
+            "hazard pointers, fixed threads number");
+    is_passed &= run_stress<StressQueue<msq::HazardPointerManager, g_fixed_threads_num>, true>(
+            "hazard pointers, fixed threads number, handles");
+    is_passed &= run_stress<StressQueue<msq::IncrementalHazardPointerManager, g_fixed_threads_num>, false>(
+            "incremental hazard pointers, fixed threads number");
+    is_passed &= check_threads_limit<msq::HazardPointerManager>("hazard pointers, threads limit");
+    is_passed &= check_threads_limit<msq::IncrementalHazardPointerManager>(
+            "incremental hazard pointers, threads limit");
+    return is_passed ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+#include <iostream>
+#include <cstring>
+#include <vector>
+#include <optional>
+#include <thread>
+
+#include "MichaelScottQueue.h"
+#include "stress.h"
+
+/// Stress tests of the queue types built on or along with Queue, ctest runs every case as a separate test:
+/// queue_types_stress <case>. stress.h checks the total count and sum and FIFO order of every producer
+/// where the type keeps it.
+
+/// Pops one value with pop and try_pop in turn, for the consumers of stress::consume.
+template<class QueueType>
+class SinglePopper {
+public:
+    explicit SinglePopper(QueueType& queue) : _queue(queue) {}
+
+    size_t operator()(std::vector<uint64_t>& values) {
+        _is_try_pop = !_is_try_pop;
+        if (_is_try_pop) {
+            std::optional<uint64_t> result = _queue.try_pop();
+            if (result) {
+                values.push_back(*result);
+            }
+        }
+        else {
+            uint64_t value;
+            if (_queue.pop(value)) {
+                values.push_back(value);
+            }
+        }
+        return values.size();
+    }
+
+private:
+    QueueType& _queue;
+    bool _is_try_pop = false;
+};
+
+/// Runs producers which push their values one by one and consumers which pop with SinglePopper.
+template<class QueueType>
+bool run_single_stress(const char* name, QueueType& queue, const stress::Config& config) {
+    return stress::run(name, config, [&queue, &config](uint64_t producer_id) {
+        for (uint64_t sequence = 0; sequence < config.values_per_producer; ++sequence) {
+            queue.push(stress::make_value(producer_id, sequence));
+        }
+    }, [&queue](uint64_t, stress::Totals& totals) {
+        stress::consume(totals, SinglePopper<QueueType>(queue));
+    }, [&queue]() {
+        return queue.empty();
+    });
+}
+
+/// Small segments, so producers and consumers cross segment boundaries and segments are reclaimed all the time.
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+using StressSegmentedQueue = msq::SegmentedQueue<uint64_t, msq::Dynamic_Threads_Num, 4, msq::NodePool,
+        msq::Cache_Line_Size, msq::SharedStats<>, Reclamation>;
+
+static bool run_segmented() {
+    stress::Config config;
+    bool is_passed = true;
+    {
+        StressSegmentedQueue<msq::HazardPointerManager> queue;
+        is_passed &= run_single_stress("segmented, hazard pointers", queue, config);
+    }
+    {
+        StressSegmentedQueue<msq::EpochManager> queue;
+        is_passed &= run_single_stress("segmented, epochs", queue, config);
+    }
+    return is_passed;
+}
+
+/// Fills the empty queue up to capacity and checks both bounds in one thread.
+template<class QueueType>
+bool check_bounds(const char* name) {
+    QueueType queue;
+    uint64_t value = 0;
+    bool is_passed = queue.empty() && !queue.pop(value) && !queue.try_pop();
+    for (uint64_t i = 0; i < QueueType::capacity(); ++i) {
+        is_passed &= queue.try_push(i);
+    }
+    is_passed &= !queue.try_push(QueueType::capacity()) && !queue.empty();
+    is_passed &= queue.pop(value) && value == 0;
+    is_passed &= queue.try_push(QueueType::capacity());
+    for (uint64_t i = 1; i <= QueueType::capacity(); ++i) {
+        is_passed &= queue.pop(value) && value == i;
+    }
+    is_passed &= queue.empty() && !queue.pop(value);
+    std::cout << (is_passed ? "OK     " : "FAILED ") << name
+              << ": try_push of the full queue and pop of the empty one" << std::endl;
+    return is_passed;
+}
+
+/// The capacity is much less than the number of values in flight, so producers find the queue full all the time
+/// and sleep in push until consumers free a cell, and consumers find it empty.
+static bool run_bounded() {
+    using QueueType = msq::BoundedQueue<uint64_t, 16>;
+    stress::Config config;
+    bool is_passed = check_bounds<QueueType>("bounded, bounds");
+
+    QueueType queue;
+    is_passed &= stress::run("bounded", config, [&queue, &config](uint64_t producer_id) {
+        for (uint64_t sequence = 0; sequence < config.values_per_producer; ++sequence) {
+            uint64_t value = stress::make_value(producer_id, sequence);
+            if (sequence % 2 == 0) {
+                queue.push(value);
+                continue;
+            }
+            while (!queue.try_push(value)) {
+                std::this_thread::yield();
+            }
+        }
+    }, [&queue](uint64_t, stress::Totals& totals) {
+        stress::consume(totals, SinglePopper<QueueType>(queue));
+    }, [&queue]() {
+        return queue.empty();
+    });
+    return is_passed;
+}
+
+static bool run_spsc() {
+    stress::Config config;
+    config.producer_number = 1;
+    config.consumer_number = 1;
+    msq::SpscQueue<uint64_t> queue;
+    return run_single_stress("single producer single consumer", queue, config);
+}
+
+static bool run_mpsc() {
+    stress::Config config;
+    config.consumer_number = 1;
+    msq::MpscQueue<uint64_t> queue;
+    return run_single_stress("multi producer single consumer", queue, config);
+}
+
+/// More consumers than producers keep the queue nearly empty, so pops wait in the elimination array and pushes
+/// hand values over there, a few slots make them meet more often. The number of eliminated pairs depends on timing
+/// and on the number of cpus, so it's only printed.
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+bool run_elimination(const char* name) {
+    using QueueType = msq::EliminationQueue<msq::Queue<uint64_t, msq::Dynamic_Threads_Num, msq::NodePool,
+            msq::Cache_Line_Size, msq::SharedStats<>, Reclamation>, 4>;
+    stress::Config config;
+    config.producer_number = 2;
+    config.consumer_number = 6;
+    QueueType queue;
+    bool is_passed = run_single_stress(name, queue, config);
+    std::cout << "       eliminated pairs: " << queue.GetStatistic().eliminated_pairs_number << std::endl;
+    return is_passed;
+}
+
+static bool run_elimination() {
+    bool is_passed = run_elimination<msq::HazardPointerManager>("elimination, hazard pointers");
+    is_passed &= run_elimination<msq::EpochManager>("elimination, epochs");
+    return is_passed;
+}
+
+/// Producers push only to shards 0 and 1, consumers pop from shards 2 and 3, which stay empty, so every value
+/// is stolen from another shard. Every producer has its own shard, so its values keep FIFO order.
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+bool run_sharded(const char* name) {
+    using QueueType = msq::ShardedQueue<msq::Queue<uint64_t, msq::Dynamic_Threads_Num, msq::NodePool,
+            msq::Cache_Line_Size, msq::SharedStats<>, Reclamation>>;
+    stress::Config config;
+    QueueType queue(4);
+    bool is_passed = stress::run(name, config, [&queue, &config](uint64_t producer_id) {
+        for (uint64_t sequence = 0; sequence < config.values_per_producer; ++sequence) {
+            queue.push_to(producer_id % 2, stress::make_value(producer_id, sequence));
+        }
+    }, [&queue](uint64_t consumer_id, stress::Totals& totals) {
+        size_t shard = 2 + consumer_id % 2;
+        bool is_try_pop = false;
+        stress::consume(totals, [&queue, shard, &is_try_pop](std::vector<uint64_t>& values) {
+            is_try_pop = !is_try_pop;
+            if (is_try_pop) {
+                std::optional<uint64_t> result = queue.try_pop_from(shard);
+                if (result) {
+                    values.push_back(*result);
+                }
+            }
+            else {
+                uint64_t value;
+                if (queue.pop_from(shard, value)) {
+                    values.push_back(value);
+                }
+            }
+            return values.size();
+        });
+    }, [&queue]() {
+        return queue.empty();
+    });
+
+    size_t stolen_pops_number = queue.GetStatistic().stolen_pops_number;
+    size_t expected_number = config.values_per_producer * config.producer_number;
+    if (stolen_pops_number != expected_number) {
+        std::cout << "FAILED " << name << ": stolen " << stolen_pops_number << " of " << expected_number << std::endl;
+        is_passed = false;
+    }
+    return is_passed;
+}
+
+static bool run_sharded() {
+    bool is_passed = run_sharded<msq::HazardPointerManager>("sharded, hazard pointers");
+    is_passed &= run_sharded<msq::EpochManager>("sharded, epochs");
+    return is_passed;
+}
+
+/// Every producer pushes to its own lane, so the FIFO order of every producer is the FIFO order of its lane,
+/// while pops move between the lanes by priority.
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+bool run_multilane(const char* name) {
+    stress::Config config;
+    using QueueType = msq::MultiLaneQueue<uint64_t, 4, msq::Dynamic_Threads_Num, msq::NodePool,
+            msq::Cache_Line_Size, msq::SharedStats<>, Reclamation>;
+    QueueType queue;
+    return stress::run(name, config, [&queue, &config](uint64_t producer_id) {
+        for (uint64_t sequence = 0; sequence < config.values_per_producer; ++sequence) {
+            queue.push(producer_id, stress::make_value(producer_id, sequence));
+        }
+    }, [&queue](uint64_t, stress::Totals& totals) {
+        stress::consume(totals, SinglePopper<QueueType>(queue));
+    }, [&queue]() {
+        return queue.empty();
+    });
+}
+
+static bool run_multilane() {
+    bool is_passed = run_multilane<msq::HazardPointerManager>("multilane, hazard pointers");
+    is_passed &= run_multilane<msq::EpochManager>("multilane, epochs");
+    return is_passed;
+}
+
+struct StressCase {
+    const char* name;
+    bool (* run)();
+};
+
+static const StressCase g_stress_cases[] = {
+        {"segmented", run_segmented},
+        {"bounded", run_bounded},
+        {"spsc", run_spsc},
+        {"mpsc", run_mpsc},
+        {"elimination", run_elimination},
+        {"sharded", run_sharded},
+        {"multilane", run_multilane},
+};
+
+int main(int argc, char** argv) {
+    for (const StressCase& stress_case: g_stress_cases) {
+        if (argc == 2 && std::strcmp(argv[1], stress_case.name) == 0) {
+            return stress_case.run() ? 0 : 1;
+        }
+    }
+    std::cout << "usage: " << argv[0] << " <case>, cases:";
+    for (const StressCase& stress_case: g_stress_cases) {
+        std::cout << " " << stress_case.name;
+    }
+    std::cout << std::endl;
+    return 2;
+}
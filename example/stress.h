@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/// Harness of the stress tests: producers push values producer_id << 32 | sequence number, consumers pop them
+/// and check that values of every producer come in FIFO order, the total count and sum are checked at the end.
+
+#ifdef MSQ_EXAMPLE_ITERATIONS_NUM
+static const uint64_t g_values_per_producer = MSQ_EXAMPLE_ITERATIONS_NUM;
+#else
+static const uint64_t g_values_per_producer = 99999;
+#endif
+
+namespace stress {
+
+    struct Config {
+        size_t producer_number = 4;
+        size_t consumer_number = 4;
+        uint64_t values_per_producer = g_values_per_producer;
+        /// false if the queue doesn't keep FIFO order of a producer, e.g. when elimination or stealing reorders it.
+        bool is_fifo = true;
+    };
+
+    inline uint64_t make_value(uint64_t producer_id, uint64_t sequence) {
+        return producer_id << 32 | sequence;
+    }
+
+    /// Count and sum of the popped values of all consumers.
+    class Totals {
+    public:
+        explicit Totals(const Config& config) : _config(config) {}
+
+        [[nodiscard]] bool IsDone() const {
+            return _popped_number.load(std::memory_order_relaxed) >= GetExpectedNumber();
+        }
+
+        [[nodiscard]] size_t GetProducerNumber() const {
+            return _config.producer_number;
+        }
+
+        [[nodiscard]] uint64_t GetExpectedNumber() const {
+            return _config.values_per_producer * _config.producer_number;
+        }
+
+        [[nodiscard]] uint64_t GetExpectedSum() const {
+            uint64_t expected_sum = 0;
+            for (uint64_t producer_id = 0; producer_id < _config.producer_number; ++producer_id) {
+                expected_sum += _config.values_per_producer * (producer_id << 32) +
+                                _config.values_per_producer * (_config.values_per_producer - 1) / 2;
+            }
+            return expected_sum;
+        }
+
+        /// Adds the values popped by the consumer at once, checks order of every producer with last_sequences.
+        void Add(const std::vector<uint64_t>& values, std::vector<int64_t>& last_sequences) {
+            uint64_t sum = 0;
+            for (uint64_t value: values) {
+                uint64_t producer_id = value >> 32;
+                auto sequence = static_cast<int64_t>(value & 0xffffffffu);
+                if (producer_id >= _config.producer_number ||
+                    (_config.is_fifo && sequence <= last_sequences[producer_id])) {
+                    _is_ordered.store(false, std::memory_order_relaxed);
+                }
+                else {
+                    last_sequences[producer_id] = sequence;
+                }
+                sum += value;
+            }
+            _popped_sum.fetch_add(sum, std::memory_order_relaxed);
+            _popped_number.fetch_add(values.size(), std::memory_order_relaxed);
+        }
+
+        /// Prints the result, is_empty is the emptiness of the queue after all threads are joined.
+        bool Report(const char* name, bool is_empty) const {
+            uint64_t popped_number = _popped_number.load();
+            uint64_t popped_sum = _popped_sum.load();
+            bool is_ordered = _is_ordered.load();
+            bool is_passed = is_ordered && is_empty && popped_number == GetExpectedNumber() &&
+                             popped_sum == GetExpectedSum();
+            std::cout << (is_passed ? "OK     " : "FAILED ") << name << ": popped " << popped_number << " of "
+                      << GetExpectedNumber() << ", sum " << popped_sum << " of " << GetExpectedSum()
+                      << (is_ordered ? "" : ", producer order is broken")
+                      << (is_empty ? "" : ", queue is not empty") << std::endl;
+            return is_passed;
+        }
+
+    private:
+        const Config& _config;
+        std::atomic<uint64_t> _popped_number{0};
+        std::atomic<uint64_t> _popped_sum{0};
+        std::atomic<bool> _is_ordered{true};
+    };
+
+    /// Pops with pop_values until all values of all producers are popped by the consumers,
+    /// pop_values appends the values it popped to its argument and returns their number.
+    template<class PopValues>
+    void consume(Totals& totals, PopValues pop_values) {
+        std::vector<uint64_t> values;
+        std::vector<int64_t> last_sequences(totals.GetProducerNumber(), -1);
+        while (!totals.IsDone()) {
+            values.clear();
+            if (pop_values(values) == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            totals.Add(values, last_sequences);
+        }
+    }
+
+    /// Runs producer(producer_id) and consumer(consumer_id, totals) threads and reports the totals,
+    /// is_empty() is called after the threads are joined.
+    template<class Producer, class Consumer, class IsEmpty>
+    bool run(const char* name, const Config& config, Producer producer, Consumer consumer, IsEmpty is_empty) {
+        Totals totals(config);
+        std::vector<std::thread> threads;
+        for (uint64_t i = 0; i < config.producer_number; ++i) {
+            threads.emplace_back([&producer, i]() {
+                producer(i);
+            });
+        }
+        for (uint64_t i = 0; i < config.consumer_number; ++i) {
+            threads.emplace_back([&consumer, &totals, i]() {
+                consumer(i, totals);
+            });
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+        return totals.Report(name, is_empty());
+    }
+}
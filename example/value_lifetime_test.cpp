@@ -0,0 +1,184 @@
+#include <iostream>
+#include <stdexcept>
+#include <iterator>
+#include <vector>
+
+#include "MichaelScottQueue.h"
+
+/// Checks that Queue neither copies nor leaks values: Payload is move-only and counts its live instances and
+/// the payload allocations it owns, both must be 0 when the values are destroyed and the queue is gone.
+/// ThrowingCopyPayload checks that push_range destroys the values it has copied when a copy throws.
+/// It runs for every reclamation policy.
+
+static long g_live_payloads_number = 0;
+static long g_live_allocations_number = 0;
+
+class Payload {
+public:
+    explicit Payload(int value) : _value(new int(value)) {
+        ++g_live_payloads_number;
+        ++g_live_allocations_number;
+    }
+
+    Payload(Payload&& other) noexcept : _value(other._value) {
+        other._value = nullptr;
+        ++g_live_payloads_number;
+    }
+
+    Payload& operator=(Payload&& other) noexcept {
+        if (this != &other) {
+            Release();
+            _value = other._value;
+            other._value = nullptr;
+        }
+        return *this;
+    }
+
+    Payload(const Payload&) = delete;
+
+    Payload& operator=(const Payload&) = delete;
+
+    ~Payload() {
+        Release();
+        --g_live_payloads_number;
+    }
+
+    [[nodiscard]] int GetValue() const {
+        return _value == nullptr ? -1 : *_value;
+    }
+
+private:
+    void Release() {
+        if (_value != nullptr) {
+            delete _value;
+            --g_live_allocations_number;
+        }
+    }
+
+    int* _value;
+};
+
+/// Copyable value whose copy throws for the marked instances, push_range copies values into the nodes.
+class ThrowingCopyPayload {
+public:
+    explicit ThrowingCopyPayload(int value, bool is_throwing_copy = false)
+            : _value(value), _is_throwing_copy(is_throwing_copy) {
+        ++g_live_payloads_number;
+    }
+
+    ThrowingCopyPayload(const ThrowingCopyPayload& other) : _value(other._value), _is_throwing_copy(false) {
+        if (other._is_throwing_copy) {
+            throw std::runtime_error("copy of a throwing payload");
+        }
+        ++g_live_payloads_number;
+    }
+
+    ThrowingCopyPayload& operator=(const ThrowingCopyPayload& other) = default;
+
+    ~ThrowingCopyPayload() {
+        --g_live_payloads_number;
+    }
+
+    [[nodiscard]] int GetValue() const {
+        return _value;
+    }
+
+private:
+    int _value;
+    bool _is_throwing_copy;
+};
+
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+using PayloadQueue = msq::Queue<Payload, msq::Dynamic_Threads_Num, msq::NodePool, msq::Cache_Line_Size,
+        msq::SharedStats<>, Reclamation>;
+
+template<template<class, size_t, size_t, class, class, size_t> class Reclamation>
+using ThrowingCopyQueue = msq::Queue<ThrowingCopyPayload, msq::Dynamic_Threads_Num, msq::NodePool,
+        msq::Cache_Line_Size, msq::SharedStats<>, Reclamation>;
+
+template<class QueueType, class ThrowingQueueType>
+bool run_test(const char* name) {
+    bool is_passed = true;
+    auto check = [&is_passed, name](bool condition, const char* what) {
+        if (!condition) {
+            std::cout << "FAILED " << name << ": " << what << std::endl;
+            is_passed = false;
+        }
+    };
+
+    {
+        QueueType queue;
+        queue.emplace(1);
+        queue.push(Payload(2));
+
+        std::optional<Payload> popped = queue.try_pop();
+        check(popped && popped->GetValue() == 1, "try_pop after emplace");
+        Payload result(0);
+        check(queue.pop(result) && result.GetValue() == 2, "pop after push(T&&)");
+        check(!queue.try_pop(), "try_pop of empty queue");
+
+        std::vector<Payload> batch;
+        for (int i = 3; i < 8; ++i) {
+            batch.emplace_back(i);
+        }
+        queue.push_range(std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+        batch.clear();
+
+        std::vector<Payload> bulk;
+        check(queue.pop_bulk(std::back_inserter(bulk), 3) == 3, "pop_bulk number");
+        check(bulk[0].GetValue() == 3 && bulk[1].GetValue() == 4 && bulk[2].GetValue() == 5, "pop_bulk order");
+
+        {
+            auto handle = queue.GetHandle();
+            handle.emplace(8);
+            std::optional<Payload> handle_popped = handle.try_pop();
+            check(handle_popped && handle_popped->GetValue() == 6, "try_pop of a handle");
+        }
+
+        /// values 7 and 8 stay in the queue and are destroyed with it.
+        queue.emplace(9);
+    }
+
+    {
+        /// the copy of the third value throws, values which are copied before it must be destroyed.
+        ThrowingQueueType queue;
+        std::vector<ThrowingCopyPayload> batch;
+        batch.reserve(5);
+        for (int i = 0; i < 5; ++i) {
+            batch.emplace_back(i, i == 2);
+        }
+        bool is_thrown = false;
+        try {
+            queue.push_range(batch.begin(), batch.end());
+        }
+        catch (const std::runtime_error&) {
+            is_thrown = true;
+        }
+        check(is_thrown, "push_range rethrows the copy exception");
+        check(g_live_payloads_number == 5, "values copied by a throwing push_range are destroyed");
+        check(!queue.try_pop(), "throwing push_range leaves the queue empty");
+
+        queue.push_range(batch.begin(), batch.begin() + 2);
+        std::optional<ThrowingCopyPayload> popped = queue.try_pop();
+        check(popped && popped->GetValue() == 0, "push_range after a throwing one");
+    }
+
+    check(g_live_payloads_number == 0, "live payloads after queue destruction");
+    check(g_live_allocations_number == 0, "live payload allocations after queue destruction");
+    if (is_passed) {
+        std::cout << "OK     " << name << std::endl;
+    }
+    g_live_payloads_number = 0;
+    g_live_allocations_number = 0;
+    return is_passed;
+}
+
+int main() {
+    bool is_passed = true;
+    is_passed &= run_test<PayloadQueue<msq::HazardPointerManager>, ThrowingCopyQueue<msq::HazardPointerManager>>(
+            "hazard pointers");
+    is_passed &= run_test<PayloadQueue<msq::IncrementalHazardPointerManager>,
+            ThrowingCopyQueue<msq::IncrementalHazardPointerManager>>("incremental hazard pointers");
+    is_passed &= run_test<PayloadQueue<msq::EpochManager>, ThrowingCopyQueue<msq::EpochManager>>("epochs");
+    return is_passed ? 0 : 1;
+}
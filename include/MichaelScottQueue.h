@@ -1,10 +1,38 @@
 #pragma once
 
 #include <iostream>
-#include <unordered_set>
+#include <algorithm>
 #include <array>
+#include <limits>
 #include <atomic>
 #include <memory>
+#include <new>
+#include <vector>
+#include <type_traits>
+#include <tuple>
+#include <chrono>
+#include <optional>
+#include <utility>
+#include <functional>
+#include <thread>
+#include <cassert>
+
+#ifdef __linux__
+#include <climits>
+#include <fstream>
+#include <string>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#ifdef MSQ_TRACE
+#include <mutex>
+#endif
 
 namespace msq {
 
@@ -21,419 +49,4178 @@ void dummy_debug(T t) {
     pthread_mutex_unlock(&g_cout_mutex);
 }
 
-template<class T, class... Args>
-void dummy_debug(T t, Args... args) {
-    pthread_mutex_lock(&g_cout_mutex);
-    std::cout << t;
-    dummy_debug(args...);
-    pthread_mutex_unlock(&g_cout_mutex);
-}
+template<class T, class... Args>
+void dummy_debug(T t, Args... args) {
+    pthread_mutex_lock(&g_cout_mutex);
+    std::cout << t;
+    dummy_debug(args...);
+    pthread_mutex_unlock(&g_cout_mutex);
+}
+
+#ifndef MSQ_DEBUG
+#define MSQ_LOG_DEBUG(...)
+#else
+#define MSQ_LOG_DEBUG(...)          dummy_debug(__VA_ARGS__);
+#endif
+
+/// Hot path tracing, it's compiled in only with -D MSQ_TRACE, otherwise the hooks are empty.
+/// MSQ_TRACE_START takes the start time of an operation, MSQ_TRACE_EVENT writes the event with its duration
+/// since start and a value to the ring of the calling thread, see msq::Tracer.
+#ifndef MSQ_TRACE
+#define MSQ_TRACE_START(start)
+#define MSQ_TRACE_EVENT(event, start, value)
+#else
+#define MSQ_TRACE_START(start)                  const auto start = std::chrono::steady_clock::now();
+#define MSQ_TRACE_EVENT(event, start, value)    msq::Tracer::Trace(event, start, value);
+#endif
+
+/// Events of the hot path tracing, value of push and pop events is the number of loop iterations,
+/// value of reclamation is the number of checked retired pointers.
+enum TraceEvent : uint8_t {
+    Trace_Push,
+    Trace_Pop,
+    Trace_Empty_Pop,
+    Trace_Push_Cas_Failure,
+    Trace_Pop_Cas_Failure,
+    Trace_Reclamation,
+    Trace_Events_Number
+};
+
+/// Default alignment of atomics which are written by different threads, so they don't share a cache line.
+/// It can be stabilized across compilers with -D MSQ_CACHE_LINE_SIZE=<bytes>.
+#ifdef MSQ_CACHE_LINE_SIZE
+static constexpr size_t Cache_Line_Size = MSQ_CACHE_LINE_SIZE;
+#elif defined(__cpp_lib_hardware_interference_size)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winterference-size"
+#endif
+static constexpr size_t Cache_Line_Size = std::hardware_destructive_interference_size;
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#else
+static constexpr size_t Cache_Line_Size = 64;
+#endif
+
+/// alignas can't weaken natural alignment, so too small Alignment turns padding off.
+template<class T, size_t Alignment>
+static constexpr size_t Padded_Alignment = Alignment > alignof(T) ? Alignment : alignof(T);
+
+/// Hint for the CPU that the thread is spinning.
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/// Fence pair for the hazard pointer protocols: Light is on the hot path (every Protect, every epoch announce)
+/// and is only a compiler barrier, Heavy runs before every scan of hazard pointers or epochs and makes all threads
+/// of the process execute a full fence with membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED).
+/// So a store before Light and a load after it are either both seen by the scan, or the load sees everything
+/// which was done before Heavy.
+/// Without membarrier, or with -D MSQ_NO_MEMBARRIER, both sides are seq_cst fences.
+class AsymmetricFence {
+public:
+    static void Light() {
+        if (IsMembarrierRegistered()) {
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        }
+        else {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static void Heavy() {
+#if defined(__linux__) && !defined(MSQ_NO_MEMBARRIER)
+        if (IsMembarrierRegistered()) {
+            syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+            return;
+        }
+#endif
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+private:
+    /// registration is done once, so both sides always agree on the mode.
+    static bool IsMembarrierRegistered() {
+        static const bool is_registered = RegisterMembarrier();
+        return is_registered;
+    }
+
+    static bool RegisterMembarrier() {
+#if defined(__linux__) && !defined(MSQ_NO_MEMBARRIER)
+        long commands = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+        if (commands < 0 || (commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED) == 0) {
+            return false;
+        }
+        return syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#else
+        return false;
+#endif
+    }
+};
+
+/// Buckets of the retries histograms: 0, 1, 2-3, 4-7, ..., the last one is 64 and more retries.
+static constexpr size_t Retries_Histogram_Size = 8;
+
+inline size_t GetRetriesBucket(size_t retries_number) {
+    if (retries_number == 0) {
+        return 0;
+    }
+    auto bucket = static_cast<size_t>(std::numeric_limits<unsigned long long>::digits -
+                                      __builtin_clzll(retries_number));
+    return std::min(bucket, Retries_Histogram_Size - 1);
+}
+
+/// Snapshot of queue statistic.
+/// Retries histograms count successful operations by the number of failed loop iterations before the success.
+class Statistic {
+public:
+    size_t constructed_nodes_number = 0;
+    size_t destructed_nodes_number = 0;
+    size_t loop_iterations_number_in_push = 0;
+    size_t successful_push_number = 0;
+    size_t loop_iterations_number_in_pop = 0;
+    size_t successful_pop_number = 0;
+    size_t empty_pop_number = 0;
+    size_t clearing_function_call_number = 0;
+    size_t pool_hit_number = 0;
+    size_t pool_miss_number = 0;
+    /// push/pop pairs which met in the elimination array of EliminationQueue.
+    size_t eliminated_pairs_number = 0;
+    /// pops of ShardedQueue which have been served by a remote shard.
+    size_t stolen_pops_number = 0;
+    /// the longest single reclamation pause of an operation, see IncrementalHazardPointerManager.
+    size_t max_reclamation_pause_ns = 0;
+    std::array<size_t, Retries_Histogram_Size> push_retries_histogram{};
+    std::array<size_t, Retries_Histogram_Size> pop_retries_histogram{};
+};
+
+/// Counters which are updated on the hot path, Counter is one of SharedCounter, LocalCounter and NoCounter.
+template<class Counter>
+class StatisticCounters {
+public:
+    void AddTo(Statistic& statistic) const {
+        statistic.constructed_nodes_number += constructed_nodes_number.Load();
+        statistic.destructed_nodes_number += destructed_nodes_number.Load();
+        statistic.loop_iterations_number_in_push += loop_iterations_number_in_push.Load();
+        statistic.successful_push_number += successful_push_number.Load();
+        statistic.loop_iterations_number_in_pop += loop_iterations_number_in_pop.Load();
+        statistic.successful_pop_number += successful_pop_number.Load();
+        statistic.empty_pop_number += empty_pop_number.Load();
+        statistic.clearing_function_call_number += clearing_function_call_number.Load();
+        statistic.pool_hit_number += pool_hit_number.Load();
+        statistic.pool_miss_number += pool_miss_number.Load();
+        statistic.max_reclamation_pause_ns = std::max(statistic.max_reclamation_pause_ns,
+                                                      max_reclamation_pause_ns.Load());
+        for (size_t i = 0; i < Retries_Histogram_Size; ++i) {
+            statistic.push_retries_histogram[i] += push_retries_histogram[i].Load();
+            statistic.pop_retries_histogram[i] += pop_retries_histogram[i].Load();
+        }
+    }
+
+    /// Successful operation which took loop_iterations_number iterations, all of them except the last were retries.
+    void AddPushLoopIterations(size_t loop_iterations_number) {
+        loop_iterations_number_in_push.Add(loop_iterations_number);
+        push_retries_histogram[GetRetriesBucket(loop_iterations_number - 1)].Add(1);
+    }
+
+    void AddPopLoopIterations(size_t loop_iterations_number) {
+        loop_iterations_number_in_pop.Add(loop_iterations_number);
+        pop_retries_histogram[GetRetriesBucket(loop_iterations_number - 1)].Add(1);
+    }
+
+    void AddReclamationPause(std::chrono::steady_clock::duration pause) {
+        max_reclamation_pause_ns.UpdateMax(
+                static_cast<size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(pause).count()));
+    }
+
+    Counter constructed_nodes_number;
+    Counter destructed_nodes_number;
+    Counter loop_iterations_number_in_push;
+    Counter successful_push_number;
+    Counter loop_iterations_number_in_pop;
+    Counter successful_pop_number;
+    Counter empty_pop_number;
+    Counter clearing_function_call_number;
+    Counter pool_hit_number;
+    Counter pool_miss_number;
+    Counter max_reclamation_pause_ns;
+    std::array<Counter, Retries_Histogram_Size> push_retries_histogram;
+    std::array<Counter, Retries_Histogram_Size> pop_retries_histogram;
+};
+
+/// Counter which is updated by all threads, it's padded to avoid false sharing with other counters.
+template<size_t Alignment>
+class alignas(Padded_Alignment<std::atomic<size_t>, Alignment>) SharedCounter {
+public:
+    void Add(size_t value) {
+        _value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void UpdateMax(size_t value) {
+        size_t current = _value.load(std::memory_order_relaxed);
+        while (current < value && !_value.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    [[nodiscard]] size_t Load() const {
+        return _value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> _value{0};
+};
+
+/// Counter which is updated only by its owner thread, so it doesn't need read-modify-write,
+/// it's atomic only for concurrent aggregation.
+class LocalCounter {
+public:
+    void Add(size_t value) {
+        _value.store(_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void UpdateMax(size_t value) {
+        if (_value.load(std::memory_order_relaxed) < value) {
+            _value.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]] size_t Load() const {
+        return _value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> _value{0};
+};
+
+class NoCounter {
+public:
+    void Add(size_t /*value*/) {}
+
+    void UpdateMax(size_t /*value*/) {}
+
+    [[nodiscard]] size_t Load() const {
+        return 0;
+    }
+};
+
+/// Statistic policies of Queue.
+/// LocalCounters is kept in every hazard pointers DataTLS, GetCounters returns counters for the calling thread,
+/// Collect aggregates a snapshot.
+
+/// All threads update the same padded atomics.
+template<size_t Alignment = Cache_Line_Size>
+class SharedStats {
+public:
+    class LocalCounters {
+    };
+
+    using Counters = StatisticCounters<SharedCounter<Alignment>>;
+
+    Counters& GetCounters(LocalCounters& /*local*/) {
+        return _counters;
+    }
+
+    template<class Manager>
+    Statistic Collect(Manager& /*manager*/) const {
+        Statistic statistic;
+        _counters.AddTo(statistic);
+        return statistic;
+    }
+
+private:
+    Counters _counters;
+};
+
+/// Every thread updates its own counters, they are summed up on Collect.
+/// Counters of finished threads stay in their DataTLS, so nothing is lost.
+class ThreadLocalStats {
+public:
+    using Counters = StatisticCounters<LocalCounter>;
+    using LocalCounters = Counters;
+
+    Counters& GetCounters(LocalCounters& local) {
+        return local;
+    }
+
+    template<class Manager>
+    Statistic Collect(Manager& manager) const {
+        Statistic statistic;
+        manager.ForEachTLS([&statistic](const typename Manager::DataTLS& tls) {
+            tls.GetLocalCounters().AddTo(statistic);
+        });
+        return statistic;
+    }
+};
+
+/// Statistic is compiled out, all counters are zero.
+class NoStats {
+public:
+    class LocalCounters {
+    };
+
+    using Counters = StatisticCounters<NoCounter>;
+
+    Counters& GetCounters(LocalCounters& /*local*/) {
+        return _counters;
+    }
+
+    template<class Manager>
+    Statistic Collect(Manager& /*manager*/) const {
+        return {};
+    }
+
+private:
+    Counters _counters;
+};
+
+/// Node allocator which allocates every node from the global heap, every allocation is counted as a miss.
+template<class NodeType>
+class HeapNodeAllocator {
+public:
+    /// Per-thread allocator state, HeapNodeAllocator doesn't need it.
+    class LocalCache {
+    };
+
+    template<class Counters, class... Args>
+    NodeType* New(LocalCache& /*cache*/, Counters& counters, Args&& ... args) {
+        counters.pool_miss_number.Add(1);
+        return new NodeType(std::forward<Args>(args)...);
+    }
+
+    void Delete(LocalCache& /*cache*/, NodeType* node) {
+        delete node;
+    }
+
+    void Delete(NodeType* node) {
+        delete node;
+    }
+
+    void Flush(LocalCache& /*cache*/) {}
+};
+
+/// Node allocator which keeps destroyed nodes in a per-thread free list and reuses their memory.
+/// Every thread owns its LocalCache, so New and Delete touch only the calling thread's data.
+/// When a cache grows beyond Local_Cache_Capacity (consumers delete what producers allocate)
+/// the whole cache chain is published to the shared list, from where allocating threads take it back.
+/// The shared list is lock-free: chains are pushed with CAS and taken only as a whole with exchange,
+/// so there is no ABA problem.
+template<class NodeType>
+class NodePool {
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static_assert(sizeof(NodeType) >= sizeof(FreeBlock), "node is too small to be kept in the free list");
+
+public:
+    static constexpr size_t Local_Cache_Capacity = 256;
+
+    class LocalCache {
+    private:
+        friend class NodePool<NodeType>;
+
+        FreeBlock* _head = nullptr;
+        FreeBlock* _tail = nullptr;
+        size_t _size = 0;
+    };
+
+    NodePool() = default;
+
+    /// pool must be destroyed in one thread when all caches are flushed.
+    ~NodePool() {
+        FreeBlock* current = _shared_head.load(std::memory_order_acquire);
+        while (current != nullptr) {
+            FreeBlock* next = current->next;
+            FreeStorage(current);
+            current = next;
+        }
+    }
+
+    template<class Counters, class... Args>
+    NodeType* New(LocalCache& cache, Counters& counters, Args&& ... args) {
+        void* storage = TryTakeStorage(cache);
+        if (storage != nullptr) {
+            counters.pool_hit_number.Add(1);
+        }
+        else {
+            counters.pool_miss_number.Add(1);
+            storage = std::allocator<NodeType>().allocate(1);
+        }
+
+        try {
+            return new(storage) NodeType(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            PutStorage(cache, storage);
+            throw;
+        }
+    }
+
+    void Delete(LocalCache& cache, NodeType* node) {
+        node->~NodeType();
+        PutStorage(cache, node);
+
+        if (cache._size >= Local_Cache_Capacity) {
+            Flush(cache);
+        }
+    }
+
+    /// Delete without cache, memory goes directly to the heap.
+    void Delete(NodeType* node) {
+        node->~NodeType();
+        FreeStorage(node);
+    }
+
+    /// Publishes all cached blocks to the shared list, it's called when cache overflows or its thread finishes.
+    void Flush(LocalCache& cache) {
+        if (cache._head == nullptr) {
+            return;
+        }
+
+        FreeBlock* shared_head = _shared_head.load(std::memory_order_relaxed);
+        do {
+            cache._tail->next = shared_head;
+        } while (!_shared_head.compare_exchange_weak(shared_head, cache._head, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+
+        cache._head = nullptr;
+        cache._tail = nullptr;
+        cache._size = 0;
+    }
+
+private:
+    void* TryTakeStorage(LocalCache& cache) {
+        if (cache._head == nullptr) {
+            if (_shared_head.load(std::memory_order_relaxed) == nullptr) {
+                return nullptr;
+            }
+
+            /// take the whole shared list at once, partial pop from lock-free stack is exposed to ABA.
+            FreeBlock* shared_head = _shared_head.exchange(nullptr, std::memory_order_acquire);
+            if (shared_head == nullptr) {
+                return nullptr;
+            }
+            cache._head = shared_head;
+            cache._size = 0;
+            for (FreeBlock* current = shared_head; current != nullptr && cache._size < Local_Cache_Capacity;
+                 current = current->next) {
+                cache._tail = current;
+                ++cache._size;
+            }
+
+            /// the rest goes back, otherwise other threads allocate new nodes while one thread keeps all free ones.
+            FreeBlock* rest = cache._tail->next;
+            cache._tail->next = nullptr;
+            if (rest != nullptr) {
+                PutSharedChain(rest);
+            }
+        }
+
+        FreeBlock* block = cache._head;
+        cache._head = block->next;
+        if (cache._head == nullptr) {
+            cache._tail = nullptr;
+        }
+        --cache._size;
+        return block;
+    }
+
+    /// Usually the shared list is still empty after TryTakeStorage, so the tail of the chain isn't searched.
+    void PutSharedChain(FreeBlock* chain) {
+        FreeBlock* shared_head = nullptr;
+        if (_shared_head.compare_exchange_strong(shared_head, chain, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+            return;
+        }
+
+        FreeBlock* chain_tail = chain;
+        while (chain_tail->next != nullptr) {
+            chain_tail = chain_tail->next;
+        }
+        do {
+            chain_tail->next = shared_head;
+        } while (!_shared_head.compare_exchange_weak(shared_head, chain, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+    }
+
+    void PutStorage(LocalCache& cache, void* storage) {
+        auto* block = new(storage) FreeBlock{cache._head};
+        if (cache._head == nullptr) {
+            cache._tail = block;
+        }
+        cache._head = block;
+        ++cache._size;
+    }
+
+    static void FreeStorage(void* storage) {
+        std::allocator<NodeType>().deallocate(static_cast<NodeType*>(storage), 1);
+    }
+
+    std::atomic<FreeBlock*> _shared_head{nullptr};
+};
+
+/// Max_Threads_Num value which turns off the threads limit, see HazardPointerManager.
+static constexpr size_t Dynamic_Threads_Num = 0;
+
+/// Retired pointers storage with a fixed capacity.
+template<class PtrType, size_t Capacity>
+class FixedRetiredList {
+public:
+    [[nodiscard]] size_t Size() const {
+        return _size;
+    }
+
+    bool TryAdd(PtrType ptr) {
+        if (_size == Capacity) {
+            return false;
+        }
+        _ptrs[_size++] = ptr;
+        return true;
+    }
+
+    /// Left pointers are compacted to the beginning of the same array.
+    template<class Predicate>
+    void RemoveIf(Predicate predicate) {
+        size_t new_size = 0;
+        for (size_t i = 0; i < _size; ++i) {
+            if (!predicate(_ptrs[i])) {
+                _ptrs[new_size++] = _ptrs[i];
+            }
+        }
+        _size = new_size;
+    }
+
+private:
+    std::array<PtrType, Capacity> _ptrs;
+    size_t _size = 0;
+};
+
+/// Retired pointers storage which grows by fixed-size segments, so adding never moves stored pointers.
+/// Segments aren't freed on every clearing, only the ones behind the first spare segment.
+template<class PtrType>
+class ChunkedRetiredList {
+    static constexpr size_t Segment_Size = 256;
+
+    struct Segment {
+        std::array<PtrType, Segment_Size> ptrs;
+        Segment* next = nullptr;
+    };
+
+public:
+    ChunkedRetiredList() = default;
+
+    ChunkedRetiredList(const ChunkedRetiredList&) = delete;
+
+    ChunkedRetiredList& operator=(const ChunkedRetiredList&) = delete;
+
+    ~ChunkedRetiredList() {
+        FreeSegments(_first);
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return _size;
+    }
+
+    bool TryAdd(PtrType ptr) {
+        if (_first == nullptr) {
+            _first = new Segment;
+            _last = _first;
+        }
+        else if (_last_size == Segment_Size) {
+            if (_last->next == nullptr) {
+                _last->next = new Segment;
+            }
+            _last = _last->next;
+            _last_size = 0;
+        }
+        _last->ptrs[_last_size++] = ptr;
+        ++_size;
+        return true;
+    }
+
+    /// Left pointers are compacted to the beginning of the segments list.
+    template<class Predicate>
+    void RemoveIf(Predicate predicate) {
+        if (_first == nullptr) {
+            return;
+        }
+
+        Segment* write_segment = _first;
+        size_t write_index = 0;
+        size_t new_size = 0;
+        for (Segment* read_segment = _first; read_segment != nullptr; read_segment = read_segment->next) {
+            size_t read_size = read_segment == _last ? _last_size : Segment_Size;
+            for (size_t i = 0; i < read_size; ++i) {
+                if (predicate(read_segment->ptrs[i])) {
+                    continue;
+                }
+                if (write_index == Segment_Size) {
+                    write_segment = write_segment->next;
+                    write_index = 0;
+                }
+                write_segment->ptrs[write_index++] = read_segment->ptrs[i];
+                ++new_size;
+            }
+            if (read_segment == _last) {
+                break;
+            }
+        }
+
+        _last = write_segment;
+        _last_size = write_index;
+        _size = new_size;
+        if (_last->next != nullptr) {
+            FreeSegments(_last->next->next);
+            _last->next->next = nullptr;
+        }
+    }
+
+private:
+    static void FreeSegments(Segment* segment) {
+        while (segment != nullptr) {
+            Segment* next = segment->next;
+            delete segment;
+            segment = next;
+        }
+    }
+
+    Segment* _first = nullptr;
+    Segment* _last = nullptr;
+    size_t _last_size = 0;
+    size_t _size = 0;
+};
+
+/// Retired pointers of finished threads, live threads adopt and reclaim them on their clearing.
+/// Batches are only pushed one by one and taken all at once, so the stack has no ABA problem.
+template<class RetiredType>
+class OrphanList {
+public:
+    class Batch {
+    public:
+        std::vector<RetiredType> retired;
+        Batch* next = nullptr;
+    };
+
+    OrphanList() = default;
+
+    OrphanList(const OrphanList&) = delete;
+
+    OrphanList& operator=(const OrphanList&) = delete;
+
+    /// Owner must reclaim retired pointers of the left batches before.
+    ~OrphanList() {
+        Batch* batch = _head.load(std::memory_order_relaxed);
+        while (batch != nullptr) {
+            Batch* next = batch->next;
+            delete batch;
+            batch = next;
+        }
+    }
+
+    /// release: the retired pointers are written before the batch is visible to adopting threads.
+    void Push(Batch* batch) {
+        Batch* head = _head.load(std::memory_order_relaxed);
+        do {
+            batch->next = head;
+        } while (!_head.compare_exchange_weak(head, batch, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    /// Takes all batches, the list is checked without exchange, because it's usually empty.
+    Batch* TakeAll() {
+        if (_head.load(std::memory_order_relaxed) == nullptr) {
+            return nullptr;
+        }
+        return _head.exchange(nullptr, std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<Batch*> _head{nullptr};
+};
+
+/// Per-thread DataTLS of a reclamation manager: every thread which uses the manager gets its own DataTLS,
+/// TLS of a finished thread is marked free and is reused by the next new thread.
+/// DataTLS must have "std::atomic<bool> free", "std::atomic<DataTLS*> next", a constructor from Owner*,
+/// FlushAllocatorCache and OrphanRetiredPointers.
+template<class Owner, class DataTLS>
+class TLSRegistry {
+    /// TLS of one thread in all registries of this type, a thread can use several queues.
+    class ReleaserTLS {
+    public:
+        class Record {
+        public:
+            uint64_t registry_id;
+            std::shared_ptr<std::atomic<bool>> is_registry_destructed;
+            TLSRegistry* registry;
+            DataTLS* tls;
+        };
+
+        ~ReleaserTLS() {
+            for (auto& record: records) {
+                if (!record.is_registry_destructed->load(std::memory_order_acquire)) {
+                    record.registry->ReleaseTLS(record.tls);
+                }
+            }
+        }
+
+        /// Note:
+        /// according https://en.cppreference.com/w/cpp/language/storage_duration thread storage duration:
+        /// "The storage for the object is allocated when the thread begins and deallocated when the thread ends.
+        /// Each thread has its own instance of the object."
+        /// But on MacOS I've got address sanitizer error that ReleaserTLS which was constructed not in main thread
+        /// was destructed in main thread after all other threads and HazardPointerManager destructions,
+        /// so is_registry_destructed flag fixed the compiler non-compliance with the C++ standard on MacOS.
+        /// It also skips records of managers which were destroyed before the thread finished.
+        std::vector<Record> records;
+    };
+
+    /// ids aren't reused, so a slot of a destroyed registry never matches another one.
+    class CachedTLS {
+    public:
+        uint64_t registry_id = 0;
+        DataTLS* tls = nullptr;
+    };
+
+    /// registries which are created one after another, like the shards of ShardedQueue, take different slots.
+    static constexpr size_t _cached_tls_number = 8;
+
+public:
+    explicit TLSRegistry(Owner* owner)
+            : _owner(owner),
+              _id(_next_registry_id.fetch_add(1, std::memory_order_relaxed)),
+              _is_destructed(std::make_shared<std::atomic<bool>>(false)) {}
+
+    TLSRegistry(const TLSRegistry&) = delete;
+
+    TLSRegistry& operator=(const TLSRegistry&) = delete;
+
+    /// Owner must clear retired pointers of all TLS before.
+    ~TLSRegistry() {
+        _is_destructed->store(true, std::memory_order_release);
+        DataTLS* current = _head_tls.load();
+
+        while (current != nullptr) {
+            DataTLS* next = current->next.load();
+            delete current;
+            current = next;
+        }
+    }
+
+    DataTLS* GetTLS() {
+        /// every registry has a cache slot of its id, so a thread which works with several queues, e.g. a pop
+        /// which steals from the shards of ShardedQueue, doesn't search while their ids take different slots.
+        static thread_local std::array<CachedTLS, _cached_tls_number> cache{};
+
+        CachedTLS& cached = cache[_id % _cached_tls_number];
+        if (cached.registry_id != _id) {
+            cached.tls = FindOrAcquireTLS();
+            cached.registry_id = _id;
+        }
+        return cached.tls;
+    }
+
+    /// The first TLS of the list, the next ones are reached through "next", TLS are never removed from the list.
+    DataTLS* GetFirstTLS() const {
+        return _head_tls.load(std::memory_order_acquire);
+    }
+
+    /// Visits all TLS, including free ones.
+    template<class Function>
+    void ForEachTLS(Function function) const {
+        for (DataTLS* current = _head_tls.load(std::memory_order_acquire); current != nullptr;
+             current = current->next.load(std::memory_order_acquire)) {
+            function(*current);
+        }
+    }
+
+    /// Number of threads which currently own TLS.
+    [[nodiscard]] size_t GetActiveTLSNumber() const {
+        return _active_tls_number.load(std::memory_order_relaxed);
+    }
+
+private:
+    DataTLS* FindOrAcquireTLS() {
+        /// if thread finished ReleaserTLS will clear it TLS using destructor
+        static thread_local ReleaserTLS releaser;
+
+        auto& records = releaser.records;
+        records.erase(std::remove_if(records.begin(), records.end(), [](const typename ReleaserTLS::Record& record) {
+            return record.is_registry_destructed->load(std::memory_order_acquire);
+        }), records.end());
+
+        for (auto& record: records) {
+            if (record.registry_id == _id) {
+                return record.tls;
+            }
+        }
+
+        DataTLS* tls = AcquireTLS();
+        records.push_back({_id, _is_destructed, this, tls});
+        return tls;
+    }
+
+    DataTLS* AcquireTLS() {
+        _active_tls_number.fetch_add(1, std::memory_order_relaxed);
+
+        /// if released tls exist - return it.
+        for (DataTLS* current = _head_tls.load(); current != nullptr; current = current->next.load()) {
+            bool true_cas = true;
+            if (current->free.compare_exchange_strong(true_cas, false)) {
+                return current;
+            }
+        }
+
+        auto* tls = new DataTLS(_owner);
+        while (true) {
+            DataTLS* head = _head_tls.load();
+            tls->next = head;
+            if (_head_tls.compare_exchange_strong(head, tls)) {
+                return tls;
+            }
+        }
+    }
+
+    void ReleaseTLS(DataTLS* tls) {
+        /// retired pointers go to live threads, which can reclaim them while this TLS is free.
+        tls->OrphanRetiredPointers();
+        /// cached nodes go to the shared list, so live threads can reuse them while this TLS is free.
+        tls->FlushAllocatorCache();
+        /// release: the next owner of this TLS continues with its counters.
+        tls->free.store(true, std::memory_order_release);
+        _active_tls_number.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /// ids aren't reused, unlike addresses, so a new registry never gets TLS of a destroyed one.
+    static inline std::atomic<uint64_t> _next_registry_id{1};
+
+    Owner* _owner;
+
+    std::atomic<DataTLS*> _head_tls{nullptr};
+
+    /// number of threads which currently own TLS, it scales clearing threshold with Dynamic_Threads_Num.
+    std::atomic<size_t> _active_tls_number{0};
+
+    uint64_t _id;
+
+    std::shared_ptr<std::atomic<bool>> _is_destructed;
+};
+
+#ifdef MSQ_TRACE
+#ifndef MSQ_TRACE_RING_CAPACITY
+#define MSQ_TRACE_RING_CAPACITY 4096
+#endif
+
+/// Per-thread rings of trace events of all queues. The owner thread writes to its ring without locks and
+/// drops events if the ring is full, Export drains all rings and keeps per-thread summaries.
+/// A ring of a finished thread is reused by the next new thread, so "thread" of the export is a ring index.
+class Tracer {
+public:
+    static constexpr size_t Ring_Capacity = MSQ_TRACE_RING_CAPACITY;
+    static_assert((Ring_Capacity & (Ring_Capacity - 1)) == 0, "Ring_Capacity must be a power of two");
+
+    /// bucket i > 0 of a latency histogram is [2^(i-1), 2^i) ns, the last one is 2^(size - 2) ns and more.
+    static constexpr size_t Latency_Histogram_Size = 32;
+
+    class TraceRecord {
+    public:
+        uint64_t start_ns;
+        uint32_t duration_ns;
+        uint32_t value;
+        TraceEvent event;
+    };
+
+    class EventSummary {
+    public:
+        uint64_t count = 0;
+        uint64_t total_ns = 0;
+        uint64_t max_ns = 0;
+        uint64_t value_sum = 0;
+        std::array<uint64_t, Latency_Histogram_Size> latency_histogram{};
+    };
+
+    /// Single producer single consumer ring, the owner thread writes and the exporter reads under its mutex.
+    /// It's DataTLS of TLSRegistry, a ring has nothing to flush or to orphan.
+    class Ring {
+    public:
+        explicit Ring(Tracer* /*tracer*/) : index(_next_index.fetch_add(1, std::memory_order_relaxed)) {}
+
+        std::atomic<bool> free{false};
+        std::atomic<Ring*> next{nullptr};
+
+        void FlushAllocatorCache() {}
+
+        void OrphanRetiredPointers() {}
+
+        void Push(const TraceRecord& record) {
+            uint64_t write_index = _write_index.load(std::memory_order_relaxed);
+            /// acquire: the exporter has read the slot before it's overwritten.
+            if (write_index - _read_index.load(std::memory_order_acquire) == Ring_Capacity) {
+                _dropped_number.store(_dropped_number.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            _records[write_index & (Ring_Capacity - 1)] = record;
+            /// release: the record is written before the exporter sees it.
+            _write_index.store(write_index + 1, std::memory_order_release);
+        }
+
+        template<class Function>
+        void Drain(Function function) {
+            uint64_t read_index = _read_index.load(std::memory_order_relaxed);
+            uint64_t write_index = _write_index.load(std::memory_order_acquire);
+            for (; read_index != write_index; ++read_index) {
+                function(_records[read_index & (Ring_Capacity - 1)]);
+            }
+            _read_index.store(read_index, std::memory_order_release);
+        }
+
+        [[nodiscard]] uint64_t GetDroppedNumber() const {
+            return _dropped_number.load(std::memory_order_relaxed);
+        }
+
+        const size_t index;
+
+        /// drained events, they are updated only under the export mutex.
+        std::array<EventSummary, Trace_Events_Number> summaries;
+
+    private:
+        static inline std::atomic<size_t> _next_index{0};
+
+        alignas(Cache_Line_Size) std::atomic<uint64_t> _write_index{0};
+        std::atomic<uint64_t> _dropped_number{0};
+        alignas(Cache_Line_Size) std::atomic<uint64_t> _read_index{0};
+        std::array<TraceRecord, Ring_Capacity> _records;
+    };
+
+    static void Trace(TraceEvent event, std::chrono::steady_clock::time_point start, size_t value) {
+        auto end = std::chrono::steady_clock::now();
+        TraceRecord record{
+                static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count()),
+                static_cast<uint32_t>(std::min<int64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                        std::numeric_limits<uint32_t>::max())),
+                static_cast<uint32_t>(std::min<size_t>(value, std::numeric_limits<uint32_t>::max())),
+                event};
+        GetInstance()._registry.GetTLS()->Push(record);
+    }
+
+    /// Drains all rings to their summaries, a thread which calls it periodically keeps rings from dropping events.
+    static void Collect() {
+        Tracer& tracer = GetInstance();
+        std::lock_guard<std::mutex> lock(tracer._export_mutex);
+        tracer.CollectLocked();
+    }
+
+    /// Drains all rings and writes cumulative summaries of every ring as CSV for offline analysis:
+    /// "thread,event,count,total_ns,max_ns,value_sum,dropped,latency_histogram", the histogram is space separated.
+    /// Reclamation events are the clearing pauses.
+    static void Export(std::ostream& out) {
+        static constexpr const char* event_names[Trace_Events_Number] = {
+                "push", "pop", "empty_pop", "push_cas_failure", "pop_cas_failure", "reclamation"};
+
+        Tracer& tracer = GetInstance();
+        std::lock_guard<std::mutex> lock(tracer._export_mutex);
+        tracer.CollectLocked();
+
+        out << "thread,event,count,total_ns,max_ns,value_sum,dropped,latency_histogram\n";
+        tracer._registry.ForEachTLS([&out](const Ring& ring) {
+            for (size_t event = 0; event < Trace_Events_Number; ++event) {
+                const EventSummary& summary = ring.summaries[event];
+                if (summary.count == 0) {
+                    continue;
+                }
+                out << ring.index << ',' << event_names[event] << ',' << summary.count << ',' << summary.total_ns
+                    << ',' << summary.max_ns << ',' << summary.value_sum << ',' << ring.GetDroppedNumber() << ',';
+                for (size_t i = 0; i < Latency_Histogram_Size; ++i) {
+                    out << (i == 0 ? "" : " ") << summary.latency_histogram[i];
+                }
+                out << '\n';
+            }
+        });
+    }
+
+private:
+    Tracer() : _registry(this) {}
+
+    static Tracer& GetInstance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    void CollectLocked() {
+        _registry.ForEachTLS([](Ring& ring) {
+            ring.Drain([&ring](const TraceRecord& record) {
+                EventSummary& summary = ring.summaries[record.event];
+                ++summary.count;
+                summary.total_ns += record.duration_ns;
+                summary.max_ns = std::max<uint64_t>(summary.max_ns, record.duration_ns);
+                summary.value_sum += record.value;
+                ++summary.latency_histogram[GetLatencyBucket(record.duration_ns)];
+            });
+        });
+    }
+
+    static size_t GetLatencyBucket(uint32_t duration_ns) {
+        if (duration_ns == 0) {
+            return 0;
+        }
+        auto bucket = static_cast<size_t>(std::numeric_limits<unsigned int>::digits - __builtin_clz(duration_ns));
+        return std::min(bucket, Latency_Histogram_Size - 1);
+    }
+
+    std::mutex _export_mutex;
+
+    TLSRegistry<Tracer, Ring> _registry;
+};
+#endif
+
+template<class Manager>
+class HazardPointer;
+
+/// Max_Threads_Num sizes retired pointers array of every thread and it's the limit of threads number
+/// which can use the manager at the same time.
+/// With Dynamic_Threads_Num there is no limit: retired pointers are kept in ChunkedRetiredList and
+/// they are cleared when their number reaches 2 * Max_Hazard_Pointers_Num * (number of active threads),
+/// so every clearing frees at least half of them and reclamation stays amortized O(1) for any threads number.
+/// The threshold is at least 64, so the heavy fence of every clearing is amortized with a few threads too.
+/// With Reclamation_Step == 0 the clearing runs at once in the Retire which reaches the threshold, otherwise it's
+/// incremental: that Retire only moves retired pointers to a batch and runs the heavy fence, and every following
+/// Retire does one step - scans hazard pointers of one TLS or checks Reclamation_Step pointers of the batch.
+/// If the threshold is reached again before the batch is done, the rest of it is done at once.
+/// Use HazardPointerManager and IncrementalHazardPointerManager aliases below.
+template<class PtrType, size_t Max_Hazard_Pointers_Num, size_t Max_Threads_Num, class Allocator, class Stats,
+        size_t Alignment, size_t Reclamation_Step>
+class BasicHazardPointerManager {
+    static_assert(Max_Hazard_Pointers_Num > 0 && Max_Hazard_Pointers_Num <= 64,
+                  "Allocated hazard pointers of a thread are kept in a 64-bit mask");
+
+    static constexpr bool _is_dynamic = Max_Threads_Num == Dynamic_Threads_Num;
+    static constexpr bool _is_incremental = Reclamation_Step != 0;
+
+    using OrphanBatch = typename OrphanList<PtrType>::Batch;
+
+public:
+    using ProtectedPtrType = PtrType;
+
+    /// every hazard pointer is in its own cache line, the owner writes it on every Protect.
+    class alignas(Padded_Alignment<std::atomic<ProtectedPtrType>, Alignment>) InnerHazardPointer {
+    public:
+        std::atomic<bool> free{true};
+        std::atomic<ProtectedPtrType> ptr;
+    };
+
+    /// Sorted snapshot of used hazard pointers, it lives on the stack of the clearing thread,
+    /// so reclamation doesn't allocate memory.
+    /// With Dynamic_Threads_Num it's kept in the clearing thread TLS and grows only with threads number.
+    class HazardPointersSnapshot {
+    public:
+        [[nodiscard]] bool Contains(ProtectedPtrType ptr) const {
+            return std::binary_search(_ptrs.begin(), _ptrs.begin() + _size, ptr);
+        }
+
+        [[nodiscard]] size_t Size() const {
+            return _size;
+        }
+
+    private:
+        friend class BasicHazardPointerManager;
+
+        void Add(ProtectedPtrType ptr) {
+            if (_size == _ptrs.size()) {
+                if constexpr (_is_dynamic) {
+                    _ptrs.resize(std::max(_ptrs.size() * 2, Max_Hazard_Pointers_Num));
+                }
+                else {
+                    throw std::logic_error(
+                            "Too many used hazard pointers, probably the limit of threads number has been exceeded");
+                }
+            }
+            _ptrs[_size++] = ptr;
+        }
+
+        std::conditional_t<_is_dynamic,
+                std::vector<ProtectedPtrType>,
+                std::array<ProtectedPtrType, Max_Hazard_Pointers_Num * Max_Threads_Num>> _ptrs;
+        size_t _size = 0;
+    };
+
+    class DataTLS {
+    public:
+
+        ~DataTLS() {
+            MSQ_LOG_DEBUG("TLS destructed in thread ", std::this_thread::get_id());
+        }
+
+        DataTLS(BasicHazardPointerManager* manager_tls)
+                : _manager_tls(manager_tls) {
+            for (auto& _inner_hazard: _inner_hazard_ptr_array) {
+                _inner_hazard.free.store(true, std::memory_order_relaxed);
+            }
+            MSQ_LOG_DEBUG("DataTLS constructed in thread ", std::this_thread::get_id());
+        }
+
+        std::atomic<bool> free{false};
+        std::atomic<DataTLS*> next{nullptr};
+
+
+        /// Allocate always happens from the same thread, it takes the first free slot.
+        /// relaxed: the hazard pointer isn't used before Protect, and Protect orders it with AsymmetricFence.
+        InnerHazardPointer* TryAllocateHazardPtr() {
+            if (_used_hazard_ptrs_mask == _all_hazard_ptrs_mask) {
+                return nullptr;
+            }
+            auto index = static_cast<size_t>(__builtin_ctzll(~_used_hazard_ptrs_mask));
+            _used_hazard_ptrs_mask |= uint64_t{1} << index;
+            _inner_hazard_ptr_array[index].free.store(false, std::memory_order_relaxed);
+            return &_inner_hazard_ptr_array[index];
+        }
+
+        /// Deallocate always happens from the same thread, it frees exactly the slot of ptr, so hazard pointers
+        /// (and handles which keep them) can be released in any order.
+        /// release: accesses to the protected node happen before the clearing thread which sees it free deletes it.
+        void DeallocateHazardPtr(InnerHazardPointer* ptr) {
+            auto index = static_cast<size_t>(ptr - _inner_hazard_ptr_array.data());
+            assert(index < Max_Hazard_Pointers_Num && (_used_hazard_ptrs_mask & (uint64_t{1} << index)) != 0 &&
+                   "Hazard pointer isn't allocated in this TLS");
+            ptr->free.store(true, std::memory_order_release);
+            _used_hazard_ptrs_mask &= ~(uint64_t{1} << index);
+        }
+
+        bool TryAddRetiredPtr(ProtectedPtrType ptr) {
+            return _retired_ptrs.TryAdd(ptr);
+        }
+
+        [[nodiscard]] bool IsClearingThresholdReached() const {
+            if constexpr (_is_dynamic) {
+                /// every clearing costs a heavy fence, so there is a minimum for a few threads.
+                size_t active_tls_number = _manager_tls->_tls_registry.GetActiveTLSNumber();
+                return _retired_ptrs.Size() >= std::max(2 * Max_Hazard_Pointers_Num * active_tls_number,
+                                                        _min_dynamic_clearing_threshold);
+            }
+            else {
+                return _retired_ptrs.Size() == _max_retired_ptrs_num();
+            }
+        }
+
+        /// Called when the threshold is reached, the pause is measured for max_reclamation_pause_ns.
+        void ClearRetiredPointers() {
+            auto start = std::chrono::steady_clock::now();
+            [[maybe_unused]] size_t retired_ptrs_number = _retired_ptrs.Size();
+            if constexpr (_is_incremental) {
+                while (_reclamation_phase != Reclamation_Idle) {
+                    StepReclamation();
+                }
+                StartReclamation();
+            }
+            else if constexpr (_is_dynamic) {
+                ClearRetiredPointers(_used_hazard_pointers);
+            }
+            else {
+                HazardPointersSnapshot used_hazard_pointers;
+                ClearRetiredPointers(used_hazard_pointers);
+            }
+            GetCounters().AddReclamationPause(std::chrono::steady_clock::now() - start);
+            MSQ_TRACE_EVENT(Trace_Reclamation, start, retired_ptrs_number);
+        }
+
+        /// One bounded step of incremental reclamation, it does nothing if there is no batch.
+        /// Pointers of the batch [0, _batch_kept) are protected, [_batch_checked, size) aren't checked yet.
+        void StepReclamation() {
+            if constexpr (_is_incremental) {
+                if (_reclamation_phase == Reclamation_Scanning) {
+                    if (_scanned_tls != nullptr) {
+                        AddUsedHazardPointers(*_scanned_tls, _used_hazard_pointers);
+                        _scanned_tls = _scanned_tls->next.load(std::memory_order_acquire);
+                    }
+                    if (_scanned_tls == nullptr) {
+                        SortUsedHazardPointers(_used_hazard_pointers);
+                        _reclamation_phase = Reclamation_Checking;
+                    }
+                }
+                else if (_reclamation_phase == Reclamation_Checking) {
+                    size_t end = std::min(_batch_checked + Reclamation_Step, _batch.size());
+                    size_t destructed_number = 0;
+                    for (; _batch_checked < end; ++_batch_checked) {
+                        ProtectedPtrType ptr = _batch[_batch_checked];
+                        if (_used_hazard_pointers.Contains(ptr)) {
+                            _batch[_batch_kept++] = ptr;
+                        }
+                        else {
+                            _manager_tls->_allocator.Delete(_allocator_cache, ptr);
+                            ++destructed_number;
+                        }
+                    }
+
+                    auto& counters = GetCounters();
+                    counters.destructed_nodes_number.Add(destructed_number);
+                    if (_batch_checked == _batch.size()) {
+                        _batch.resize(_batch_kept);
+                        _batch_checked = _batch_kept;
+                        _reclamation_phase = Reclamation_Idle;
+                        counters.clearing_function_call_number.Add(1);
+                    }
+                }
+            }
+        }
+
+        /// The owner thread is finishing, its retired pointers, with the unchecked part of the batch, are published
+        /// to the orphan list, so they don't wait for the next owner of this TLS.
+        void OrphanRetiredPointers() {
+            auto* batch = new OrphanBatch;
+            _retired_ptrs.RemoveIf([batch](ProtectedPtrType ptr) {
+                batch->retired.push_back(ptr);
+                return true;
+            });
+            if constexpr (_is_incremental) {
+                for (size_t i = 0; i < _batch.size(); ++i) {
+                    if (i < _batch_kept || i >= _batch_checked) {
+                        batch->retired.push_back(_batch[i]);
+                    }
+                }
+                _batch.clear();
+                _batch_kept = 0;
+                _batch_checked = 0;
+                _reclamation_phase = Reclamation_Idle;
+            }
+
+            if (batch->retired.empty()) {
+                delete batch;
+                return;
+            }
+            _manager_tls->_orphans.Push(batch);
+        }
+
+        void ForceClearRetiredPointers() {
+            _retired_ptrs.RemoveIf([this](ProtectedPtrType ptr) {
+                _manager_tls->_allocator.Delete(_allocator_cache, ptr);
+                return true;
+            });
+            if constexpr (_is_incremental) {
+                for (size_t i = 0; i < _batch.size(); ++i) {
+                    if (i < _batch_kept || i >= _batch_checked) {
+                        _manager_tls->_allocator.Delete(_allocator_cache, _batch[i]);
+                    }
+                }
+                _batch.clear();
+                _batch_kept = 0;
+                _batch_checked = 0;
+                _reclamation_phase = Reclamation_Idle;
+            }
+        }
+
+        /// Cache is used only by the thread which owns this DataTLS.
+        typename Allocator::LocalCache& GetAllocatorCache() {
+            return _allocator_cache;
+        }
+
+        void FlushAllocatorCache() {
+            _manager_tls->_allocator.Flush(_allocator_cache);
+        }
+
+        /// Counters are updated only by the thread which owns this DataTLS.
+        typename Stats::Counters& GetCounters() {
+            return _manager_tls->_stats.GetCounters(_local_counters);
+        }
+
+        const typename Stats::LocalCounters& GetLocalCounters() const {
+            return _local_counters;
+        }
+
+
+    private:
+        friend class BasicHazardPointerManager;
+
+        enum ReclamationPhase : uint8_t {
+            Reclamation_Idle,
+            Reclamation_Scanning,
+            Reclamation_Checking
+        };
+
+        /// Retired pointers go to the batch after the protected ones of the previous batch, then the heavy fence
+        /// makes hazard pointers of all threads visible, so the batch can be checked against them later.
+        /// Orphans are adopted to the batch before the fence too.
+        void StartReclamation() {
+            _retired_ptrs.RemoveIf([this](ProtectedPtrType ptr) {
+                _batch.push_back(ptr);
+                return true;
+            });
+            OrphanBatch* orphans = _manager_tls->_orphans.TakeAll();
+            while (orphans != nullptr) {
+                _batch.insert(_batch.end(), orphans->retired.begin(), orphans->retired.end());
+                OrphanBatch* next = orphans->next;
+                delete orphans;
+                orphans = next;
+            }
+            _batch_kept = 0;
+            _batch_checked = 0;
+            _scanned_tls = _manager_tls->StartUsedHazardPointersScan(_used_hazard_pointers);
+            _reclamation_phase = Reclamation_Scanning;
+        }
+
+        /// Orphans are taken before the fence of the snapshot, so they are checked against it as own pointers.
+        /// Protected orphans are published back, the fixed retired list may have no space for them.
+        void ClearRetiredPointers(HazardPointersSnapshot& used_hazard_pointers) {
+            OrphanBatch* orphans = _manager_tls->_orphans.TakeAll();
+            _manager_tls->GetUsedHazardPointers(used_hazard_pointers);
+
+            auto is_deleted = [this, &used_hazard_pointers](ProtectedPtrType ptr) {
+                if (used_hazard_pointers.Contains(ptr)) {
+                    return false;
+                }
+                _manager_tls->_allocator.Delete(_allocator_cache, ptr);
+                return true;
+            };
+
+            size_t retired_ptrs_number = _retired_ptrs.Size();
+            _retired_ptrs.RemoveIf(is_deleted);
+            size_t destructed_number = retired_ptrs_number - _retired_ptrs.Size();
+
+            while (orphans != nullptr) {
+                OrphanBatch* next = orphans->next;
+                auto& retired = orphans->retired;
+                size_t orphans_number = retired.size();
+                retired.erase(std::remove_if(retired.begin(), retired.end(), is_deleted), retired.end());
+                destructed_number += orphans_number - retired.size();
+                if (retired.empty()) {
+                    delete orphans;
+                }
+                else {
+                    _manager_tls->_orphans.Push(orphans);
+                }
+                orphans = next;
+            }
+
+            auto& counters = GetCounters();
+            counters.clearing_function_call_number.Add(1);
+            counters.destructed_nodes_number.Add(destructed_number);
+        }
+
+        BasicHazardPointerManager* _manager_tls;
+
+        static constexpr int _max_hazard_ptrs_num() {
+            return Max_Hazard_Pointers_Num;
+        }
+
+        static constexpr size_t _max_retired_ptrs_num() {
+            return Max_Hazard_Pointers_Num * Max_Threads_Num;
+        }
+
+        static constexpr size_t _min_dynamic_clearing_threshold = 64;
+
+        static constexpr uint64_t _all_hazard_ptrs_mask =
+                Max_Hazard_Pointers_Num == 64 ? ~uint64_t{0} : (uint64_t{1} << Max_Hazard_Pointers_Num) - 1;
+
+        std::array<InnerHazardPointer, Max_Hazard_Pointers_Num> _inner_hazard_ptr_array;
+        /// bit i is set when the hazard pointer i is allocated, it's used only by the owner thread.
+        uint64_t _used_hazard_ptrs_mask = 0;
+
+        std::conditional_t<_is_dynamic,
+                ChunkedRetiredList<ProtectedPtrType>,
+                FixedRetiredList<ProtectedPtrType, _max_retired_ptrs_num()>> _retired_ptrs;
+
+        /// used only with Dynamic_Threads_Num or incremental reclamation, otherwise the snapshot is on the stack.
+        std::conditional_t<_is_dynamic || _is_incremental, HazardPointersSnapshot, std::tuple<>> _used_hazard_pointers;
+
+        /// incremental reclamation state, the batch keeps its capacity, so it allocates only while it grows.
+        std::conditional_t<_is_incremental, std::vector<ProtectedPtrType>, std::tuple<>> _batch;
+        size_t _batch_kept = 0;
+        size_t _batch_checked = 0;
+        DataTLS* _scanned_tls = nullptr;
+        ReclamationPhase _reclamation_phase = Reclamation_Idle;
+
+        typename Allocator::LocalCache _allocator_cache;
+        typename Stats::LocalCounters _local_counters;
+    };
+
+public:
+    using Guard = HazardPointer<BasicHazardPointerManager>;
+
+    BasicHazardPointerManager(Allocator& allocator, Stats& stats)
+            : _allocator(allocator),
+              _stats(stats),
+              _tls_registry(this) {}
+
+    ~BasicHazardPointerManager() {
+        typename Allocator::LocalCache cache;
+        for (OrphanBatch* orphans = _orphans.TakeAll(); orphans != nullptr;) {
+            for (ProtectedPtrType ptr: orphans->retired) {
+                _allocator.Delete(cache, ptr);
+            }
+            OrphanBatch* next = orphans->next;
+            delete orphans;
+            orphans = next;
+        }
+        _allocator.Flush(cache);
+
+        _tls_registry.ForEachTLS([](DataTLS& tls) {
+            tls.ForceClearRetiredPointers();
+            tls.FlushAllocatorCache();
+        });
+        MSQ_LOG_DEBUG("HazardPointerManager destructed in thread ", std::this_thread::get_id());
+    }
+
+    DataTLS* GetTLS() {
+        return _tls_registry.GetTLS();
+    }
+
+    /// Visits all TLS, including free ones.
+    template<class Function>
+    void ForEachTLS(Function function) const {
+        _tls_registry.ForEachTLS(function);
+    }
+
+    void GetUsedHazardPointers(HazardPointersSnapshot& snapshot) {
+        for (DataTLS* tls = StartUsedHazardPointersScan(snapshot); tls != nullptr;
+             tls = tls->next.load(std::memory_order_acquire)) {
+            AddUsedHazardPointers(*tls, snapshot);
+        }
+        SortUsedHazardPointers(snapshot);
+    }
+
+private:
+    /// Returns the first TLS to scan. Hazard pointers can be scanned long after the fence: a pointer retired
+    /// before it can't be protected by a Protect which isn't visible to the fence, because its validation fails.
+    DataTLS* StartUsedHazardPointersScan(HazardPointersSnapshot& snapshot) {
+        /// pairs with AsymmetricFence::Light in Protect.
+        AsymmetricFence::Heavy();
+
+        snapshot._size = 0;
+        return _tls_registry.GetFirstTLS();
+    }
+
+    static void AddUsedHazardPointers(const DataTLS& tls, HazardPointersSnapshot& snapshot) {
+        /// acquire: accesses of a finished thread happen before deletions of nodes it has protected.
+        if (tls.free.load(std::memory_order_acquire)) {
+            return;
+        }
+        for (int i = 0; i < tls._max_hazard_ptrs_num(); ++i) {
+            if (!tls._inner_hazard_ptr_array[i].free.load(std::memory_order_acquire)) {
+                snapshot.Add(tls._inner_hazard_ptr_array[i].ptr.load(std::memory_order_acquire));
+            }
+        }
+    }
+
+    static void SortUsedHazardPointers(HazardPointersSnapshot& snapshot) {
+        std::sort(snapshot._ptrs.begin(), snapshot._ptrs.begin() + snapshot._size);
+    }
+
+    Allocator& _allocator;
+
+    Stats& _stats;
+
+    OrphanList<ProtectedPtrType> _orphans;
+
+    TLSRegistry<BasicHazardPointerManager, DataTLS> _tls_registry;
+};
+
+/// Clearing at once when the threshold is reached.
+template<class PtrType, size_t Max_Hazard_Pointers_Num, size_t Max_Threads_Num, class Allocator,
+        class Stats = NoStats, size_t Alignment = Cache_Line_Size>
+using HazardPointerManager = BasicHazardPointerManager<PtrType, Max_Hazard_Pointers_Num, Max_Threads_Num, Allocator,
+        Stats, Alignment, 0>;
+
+/// Incremental clearing in steps of 16 pointers: the longest pause of an operation is the heavy fence
+/// instead of the scan of all hazard pointers and deletion of all retired nodes.
+template<class PtrType, size_t Max_Hazard_Pointers_Num, size_t Max_Threads_Num, class Allocator,
+        class Stats = NoStats, size_t Alignment = Cache_Line_Size>
+using IncrementalHazardPointerManager = BasicHazardPointerManager<PtrType, Max_Hazard_Pointers_Num, Max_Threads_Num,
+        Allocator, Stats, Alignment, 16>;
+
+template<class Manager>
+class HazardPointer {
+    using ProtectedPtrType = typename Manager::ProtectedPtrType;
+    using InnerHazardPtr = typename Manager::InnerHazardPointer;
+
+public:
+    using TLS = typename Manager::DataTLS;
+
+    /// a hazard pointer can stay allocated between operations, see CachedGuards.
+    static constexpr bool Is_Reusable = true;
+
+    HazardPointer(Manager* manager_tls) : HazardPointer(manager_tls->GetTLS()) {}
+
+    explicit HazardPointer(TLS* tls)
+            : _tls(tls) {
+        _inner_hazard_pointer = _tls->TryAllocateHazardPtr();
+        if (_inner_hazard_pointer == nullptr) {
+            throw std::logic_error(
+                    "Can't allocate new hazard pointer, probably the limit of hazard pointer number has been exceeded");
+        }
+    }
+
+    ~HazardPointer() {
+        _tls->DeallocateHazardPtr(_inner_hazard_pointer);
+    }
+
+    TLS* GetTLS() const {
+        return _tls;
+    }
+
+    void Retire() {
+        Retire(_inner_hazard_pointer->ptr);
+    }
+
+    /// Retires a pointer which isn't protected by this hazard pointer, but was unlinked by this thread.
+    /// The pointer is added before the clearing, so it isn't lost if the clearing throws.
+    void Retire(ProtectedPtrType ptr) {
+        bool is_added = _tls->TryAddRetiredPtr(ptr);
+        if (_tls->IsClearingThresholdReached()) {
+            _tls->ClearRetiredPointers();
+        }
+        else {
+            _tls->StepReclamation();
+        }
+        if (!is_added && !_tls->TryAddRetiredPtr(ptr)) {
+            throw std::logic_error("Still there is no space for retired_ptr, after clearing");
+        }
+    }
+
+    ProtectedPtrType Protect(const std::atomic<ProtectedPtrType>& ptr) {
+        /// This construction is important because we can sleep on first ptr.load() and during this sleep
+        /// clearing function can start and delete ptr that we loaded.
+        /// The hazard pointer store and the validation load are ordered by AsymmetricFence: either the clearing
+        /// thread sees the hazard pointer, or the validation sees that ptr was unlinked.
+        /// release: if the hazard pointer is overwritten, accesses to the previous node happen before its deletion.
+        ProtectedPtrType protected_ptr = ptr.load(std::memory_order_relaxed);
+        while (true) {
+            _inner_hazard_pointer->ptr.store(protected_ptr, std::memory_order_release);
+            AsymmetricFence::Light();
+            ProtectedPtrType current_ptr = ptr.load(std::memory_order_acquire);
+            if (current_ptr == protected_ptr) {
+                return protected_ptr;
+            }
+            protected_ptr = current_ptr;
+        }
+    }
+
+private:
+    TLS* _tls;
+    InnerHazardPtr* _inner_hazard_pointer;
+};
+
+template<class Manager>
+class EpochGuard;
+
+/// Epoch-based reclamation with the interface of HazardPointerManager, Queue takes it as the Reclamation policy.
+/// A thread announces the global epoch when it takes the first EpochGuard and leaves it with the last one,
+/// so an operation costs one announce however many guards it takes, and Protect is a plain load.
+/// The epoch is advanced only when every thread inside a guard has announced the current one, so a pointer
+/// retired in announced epoch e can't be seen by anybody when the global epoch reaches e + 3.
+/// Unlike hazard pointers, a thread which stalls inside a guard stops reclamation in all threads.
+/// Max_Guards_Num isn't used, it keeps the signature of HazardPointerManager. Retired pointers are kept
+/// in ChunkedRetiredList with any Max_Threads_Num, so there is no threads limit.
+template<class PtrType, size_t Max_Guards_Num, size_t Max_Threads_Num, class Allocator,
+        class Stats = NoStats, size_t Alignment = Cache_Line_Size>
+class EpochManager {
+    static constexpr uint64_t _inactive_epoch = std::numeric_limits<uint64_t>::max();
+
+    class RetiredPtr {
+    public:
+        PtrType ptr;
+        uint64_t epoch;
+    };
+
+    using OrphanBatch = typename OrphanList<RetiredPtr>::Batch;
+
+public:
+    using ProtectedPtrType = PtrType;
+    using Guard = EpochGuard<EpochManager>;
+
+    class DataTLS {
+    public:
+        explicit DataTLS(EpochManager* manager) : _manager(manager) {
+            MSQ_LOG_DEBUG("Epoch DataTLS constructed in thread ", std::this_thread::get_id());
+        }
+
+        std::atomic<bool> free{false};
+        std::atomic<DataTLS*> next{nullptr};
+
+        /// Enter and Leave always happen in the owner thread, only the outermost guard announces.
+        void Enter() {
+            if (_guards_number++ != 0) {
+                return;
+            }
+            /// the announce must be visible before the following loads of shared pointers, the fence pairs with
+            /// the heavy one in TryAdvanceEpoch. The global epoch is read again, because it could be advanced
+            /// while this thread was announcing the old one.
+            uint64_t epoch = _manager->_global_epoch.load(std::memory_order_relaxed);
+            while (true) {
+                _epoch.store(epoch, std::memory_order_release);
+                AsymmetricFence::Light();
+                uint64_t current_epoch = _manager->_global_epoch.load(std::memory_order_relaxed);
+                if (current_epoch == epoch) {
+                    return;
+                }
+                epoch = current_epoch;
+            }
+        }
+
+        void Leave() {
+            if (--_guards_number == 0) {
+                /// release: accesses of this guard happen before the pointers are deleted.
+                _epoch.store(_inactive_epoch, std::memory_order_release);
+            }
+        }
+
+        /// Must be called inside a guard.
+        void Retire(ProtectedPtrType ptr) {
+            _retired_ptrs.TryAdd({ptr, _epoch.load(std::memory_order_relaxed)});
+            if (_retired_ptrs.Size() >= _clearing_threshold) {
+                ClearRetiredPointers();
+            }
+        }
+
+        /// Runs every _clearing_period retired pointers, pointers are scanned only if the global epoch has changed,
+        /// so a stalled thread costs one pass over TLS per period.
+        void ClearRetiredPointers() {
+            auto start = std::chrono::steady_clock::now();
+            AdoptOrphans();
+            uint64_t global_epoch = _manager->TryAdvanceEpoch();
+            _clearing_threshold = _retired_ptrs.Size() + _clearing_period;
+            if (global_epoch == _last_clearing_epoch) {
+                GetCounters().AddReclamationPause(std::chrono::steady_clock::now() - start);
+                MSQ_TRACE_EVENT(Trace_Reclamation, start, 0);
+                return;
+            }
+            _last_clearing_epoch = global_epoch;
+
+            size_t retired_ptrs_number = _retired_ptrs.Size();
+            _retired_ptrs.RemoveIf([this, global_epoch](const RetiredPtr& retired) {
+                if (retired.epoch + 3 > global_epoch) {
+                    return false;
+                }
+                _manager->_allocator.Delete(_allocator_cache, retired.ptr);
+                return true;
+            });
+            _clearing_threshold = _retired_ptrs.Size() + _clearing_period;
+
+            auto& counters = GetCounters();
+            counters.clearing_function_call_number.Add(1);
+            counters.destructed_nodes_number.Add(retired_ptrs_number - _retired_ptrs.Size());
+            counters.AddReclamationPause(std::chrono::steady_clock::now() - start);
+            MSQ_TRACE_EVENT(Trace_Reclamation, start, retired_ptrs_number);
+        }
+
+        /// The owner thread is finishing, its retired pointers keep their epochs in the orphan list.
+        void OrphanRetiredPointers() {
+            if (_retired_ptrs.Size() == 0) {
+                return;
+            }
+            auto* batch = new OrphanBatch;
+            _retired_ptrs.RemoveIf([batch](const RetiredPtr& retired) {
+                batch->retired.push_back(retired);
+                return true;
+            });
+            _manager->_orphans.Push(batch);
+            _clearing_threshold = _clearing_period;
+        }
+
+        void ForceClearRetiredPointers() {
+            _retired_ptrs.RemoveIf([this](const RetiredPtr& retired) {
+                _manager->_allocator.Delete(_allocator_cache, retired.ptr);
+                return true;
+            });
+        }
+
+        [[nodiscard]] size_t GetRetiredPtrsNumber() const {
+            return _retired_ptrs.Size();
+        }
+
+        /// Cache is used only by the thread which owns this DataTLS.
+        typename Allocator::LocalCache& GetAllocatorCache() {
+            return _allocator_cache;
+        }
+
+        void FlushAllocatorCache() {
+            _manager->_allocator.Flush(_allocator_cache);
+        }
+
+        /// Counters are updated only by the thread which owns this DataTLS.
+        typename Stats::Counters& GetCounters() {
+            return _manager->_stats.GetCounters(_local_counters);
+        }
+
+        const typename Stats::LocalCounters& GetLocalCounters() const {
+            return _local_counters;
+        }
+
+    private:
+        friend class EpochManager;
+
+        /// Retired pointers of finished threads join the own ones, an epoch is global, so they are reclaimed
+        /// as if they were retired by this thread.
+        void AdoptOrphans() {
+            OrphanBatch* orphans = _manager->_orphans.TakeAll();
+            while (orphans != nullptr) {
+                for (const RetiredPtr& retired: orphans->retired) {
+                    _retired_ptrs.TryAdd(retired);
+                }
+                OrphanBatch* next = orphans->next;
+                delete orphans;
+                orphans = next;
+            }
+        }
+
+        static constexpr size_t _clearing_period = 128;
+
+        EpochManager* _manager;
+
+        /// announced epoch, it's read by threads which advance the global epoch.
+        alignas(Padded_Alignment<std::atomic<uint64_t>, Alignment>) std::atomic<uint64_t> _epoch{_inactive_epoch};
+        size_t _guards_number = 0;
+
+        ChunkedRetiredList<RetiredPtr> _retired_ptrs;
+        size_t _clearing_threshold = _clearing_period;
+        uint64_t _last_clearing_epoch = 0;
+
+        typename Allocator::LocalCache _allocator_cache;
+        typename Stats::LocalCounters _local_counters;
+    };
+
+    EpochManager(Allocator& allocator, Stats& stats)
+            : _allocator(allocator),
+              _stats(stats),
+              _tls_registry(this) {}
+
+    ~EpochManager() {
+        typename Allocator::LocalCache cache;
+        for (OrphanBatch* orphans = _orphans.TakeAll(); orphans != nullptr;) {
+            for (const RetiredPtr& retired: orphans->retired) {
+                _allocator.Delete(cache, retired.ptr);
+            }
+            OrphanBatch* next = orphans->next;
+            delete orphans;
+            orphans = next;
+        }
+        _allocator.Flush(cache);
+
+        _tls_registry.ForEachTLS([](DataTLS& tls) {
+            tls.ForceClearRetiredPointers();
+            tls.FlushAllocatorCache();
+        });
+        MSQ_LOG_DEBUG("EpochManager destructed in thread ", std::this_thread::get_id());
+    }
+
+    DataTLS* GetTLS() {
+        return _tls_registry.GetTLS();
+    }
+
+    /// Visits all TLS, including free ones.
+    template<class Function>
+    void ForEachTLS(Function function) const {
+        _tls_registry.ForEachTLS(function);
+    }
+
+    /// Advances the global epoch if all threads inside guards have announced it, returns the global epoch.
+    uint64_t TryAdvanceEpoch() {
+        uint64_t epoch = _global_epoch.load(std::memory_order_acquire);
+        AsymmetricFence::Heavy();
+
+        bool is_advanceable = true;
+        _tls_registry.ForEachTLS([epoch, &is_advanceable](const DataTLS& tls) {
+            uint64_t announced_epoch = tls._epoch.load(std::memory_order_acquire);
+            if (announced_epoch != _inactive_epoch && announced_epoch != epoch) {
+                is_advanceable = false;
+            }
+        });
+        if (is_advanceable &&
+            _global_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel,
+                                                  std::memory_order_acquire)) {
+            return epoch + 1;
+        }
+        return epoch;
+    }
+
+private:
+    Allocator& _allocator;
+
+    Stats& _stats;
+
+    alignas(Padded_Alignment<std::atomic<uint64_t>, Alignment>) std::atomic<uint64_t> _global_epoch{0};
+
+    OrphanList<RetiredPtr> _orphans;
+
+    TLSRegistry<EpochManager, DataTLS> _tls_registry;
+};
+
+/// Guard of an epoch critical section with the interface of HazardPointer:
+/// pointers loaded with Protect stay valid while any guard of the thread is alive.
+template<class Manager>
+class EpochGuard {
+    using ProtectedPtrType = typename Manager::ProtectedPtrType;
+
+public:
+    using TLS = typename Manager::DataTLS;
+
+    /// a guard kept between operations would hold the announced epoch and stop reclamation in all threads.
+    static constexpr bool Is_Reusable = false;
+
+    EpochGuard(Manager* manager) : EpochGuard(manager->GetTLS()) {}
+
+    explicit EpochGuard(TLS* tls) : _tls(tls) {
+        _tls->Enter();
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+    ~EpochGuard() {
+        _tls->Leave();
+    }
+
+    TLS* GetTLS() const {
+        return _tls;
+    }
+
+    /// Retires the last protected pointer.
+    void Retire() {
+        Retire(_ptr);
+    }
+
+    void Retire(ProtectedPtrType ptr) {
+        _tls->Retire(ptr);
+    }
+
+    ProtectedPtrType Protect(const std::atomic<ProtectedPtrType>& ptr) {
+        _ptr = ptr.load(std::memory_order_acquire);
+        return _ptr;
+    }
+
+private:
+    TLS* _tls;
+    ProtectedPtrType _ptr{};
+};
+
+/// Guards which a thread keeps for a series of operations, Queue::Handle takes them once.
+/// Reusable guards (hazard pointers) are allocated in the constructor and stay allocated until the destructor,
+/// so an operation pays only Protect. They keep protecting the last nodes between operations, which only delays
+/// deletion of these few nodes. Other guards (epochs) are taken for every operation from the cached TLS.
+template<class Guard, size_t Guards_Num, bool Is_Reusable = Guard::Is_Reusable>
+class CachedGuards {
+public:
+    explicit CachedGuards(typename Guard::TLS* tls) : CachedGuards(tls, std::make_index_sequence<Guards_Num>()) {}
+
+    /// Calls operation with Guards_Num guards.
+    template<class Operation>
+    decltype(auto) Apply(Operation&& operation) {
+        return Apply(std::forward<Operation>(operation), std::make_index_sequence<Guards_Num>());
+    }
+
+private:
+    template<size_t... Indices>
+    CachedGuards(typename Guard::TLS* tls, std::index_sequence<Indices...>)
+            : _guards{((void) Indices, Guard(tls))...} {}
+
+    template<class Operation, size_t... Indices>
+    decltype(auto) Apply(Operation&& operation, std::index_sequence<Indices...>) {
+        return std::forward<Operation>(operation)(_guards[Indices]...);
+    }
+
+    std::array<Guard, Guards_Num> _guards;
+};
+
+template<class Guard, size_t Guards_Num>
+class CachedGuards<Guard, Guards_Num, false> {
+public:
+    explicit CachedGuards(typename Guard::TLS* tls) : _tls(tls) {}
+
+    /// Calls operation with Guards_Num guards.
+    template<class Operation>
+    decltype(auto) Apply(Operation&& operation) {
+        return Apply(std::forward<Operation>(operation), std::make_index_sequence<Guards_Num>());
+    }
+
+private:
+    template<class Operation, size_t... Indices>
+    decltype(auto) Apply(Operation&& operation, std::index_sequence<Indices...>) {
+        Guard guards[Guards_Num] = {((void) Indices, Guard(_tls))...};
+        return std::forward<Operation>(operation)(guards[Indices]...);
+    }
+
+    typename Guard::TLS* _tls;
+};
+
+/// Per-thread allocator cache and statistic counters without memory reclamation, for queues in which nodes are
+/// deleted only by the single consumer, so nothing has to be protected or retired (see SingleProducerSingleConsumer
+/// and MultiProducerSingleConsumer). DataTLS has the interface of the reclamation managers for statistic policies.
+template<class Allocator, class Stats>
+class ThreadDataManager {
+public:
+    class DataTLS {
+    public:
+        explicit DataTLS(ThreadDataManager* manager) : _manager(manager) {}
+
+        std::atomic<bool> free{false};
+        std::atomic<DataTLS*> next{nullptr};
+
+        /// Cache is used only by the thread which owns this DataTLS.
+        typename Allocator::LocalCache& GetAllocatorCache() {
+            return _allocator_cache;
+        }
+
+        void FlushAllocatorCache() {
+            _manager->_allocator.Flush(_allocator_cache);
+        }
+
+        /// Nothing is retired.
+        void OrphanRetiredPointers() {}
+
+        /// Counters are updated only by the thread which owns this DataTLS.
+        typename Stats::Counters& GetCounters() {
+            return _manager->_stats.GetCounters(_local_counters);
+        }
+
+        const typename Stats::LocalCounters& GetLocalCounters() const {
+            return _local_counters;
+        }
+
+    private:
+        ThreadDataManager* _manager;
+
+        typename Allocator::LocalCache _allocator_cache;
+        typename Stats::LocalCounters _local_counters;
+    };
+
+    ThreadDataManager(Allocator& allocator, Stats& stats)
+            : _allocator(allocator),
+              _stats(stats),
+              _tls_registry(this) {}
+
+    ~ThreadDataManager() {
+        _tls_registry.ForEachTLS([](DataTLS& tls) {
+            tls.FlushAllocatorCache();
+        });
+    }
+
+    DataTLS* GetTLS() {
+        return _tls_registry.GetTLS();
+    }
+
+    /// Visits all TLS, including free ones.
+    template<class Function>
+    void ForEachTLS(Function function) const {
+        _tls_registry.ForEachTLS(function);
+    }
+
+private:
+    Allocator& _allocator;
+
+    Stats& _stats;
+
+    TLSRegistry<ThreadDataManager, DataTLS> _tls_registry;
+};
+
+/// Lets consumers sleep until a producer notifies them, it's a futex on Linux and a condition variable elsewhere.
+/// Protocol for a waiter: ticket = PrepareWait(), check the condition again, then CancelWait() or Wait(ticket).
+/// Notify costs one load while nobody waits, the caller must make the condition visible with a seq_cst operation
+/// before Notify, PrepareWait has the pairing seq_cst fence.
+class EventCount {
+public:
+    uint32_t PrepareWait() {
+        _waiters_number.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t ticket = _epoch.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return ticket;
+    }
+
+    void CancelWait() {
+        _waiters_number.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /// Returns false on timeout, wake-ups can be spurious.
+    bool Wait(uint32_t ticket, const std::optional<std::chrono::steady_clock::time_point>& deadline) {
+        bool is_notified = WaitEpochChange(ticket, deadline);
+        _waiters_number.fetch_sub(1, std::memory_order_relaxed);
+        return is_notified;
+    }
+
+    void Notify(uint32_t waiters_to_wake) {
+        if (_waiters_number.load(std::memory_order_seq_cst) == 0) {
+            return;
+        }
+        _epoch.fetch_add(1, std::memory_order_acq_rel);
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_epoch), FUTEX_WAKE_PRIVATE,
+                waiters_to_wake > INT_MAX ? INT_MAX : static_cast<int>(waiters_to_wake), nullptr, nullptr, 0);
+#else
+        { std::lock_guard<std::mutex> lock(_mutex); }
+        if (waiters_to_wake == 1) {
+            _condition.notify_one();
+        }
+        else {
+            _condition.notify_all();
+        }
+#endif
+    }
+
+private:
+    bool WaitEpochChange(uint32_t ticket, const std::optional<std::chrono::steady_clock::time_point>& deadline) {
+#ifdef __linux__
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+
+        timespec timeout{};
+        if (deadline) {
+            auto left = *deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::steady_clock::duration::zero()) {
+                return _epoch.load(std::memory_order_acquire) != ticket;
+            }
+            auto seconds = std::chrono::duration_cast<std::chrono::seconds>(left);
+            timeout.tv_sec = static_cast<time_t>(seconds.count());
+            timeout.tv_nsec = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    left - seconds).count());
+        }
+        /// the kernel compares epoch with ticket atomically with sleeping, so Notify can't be lost.
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&_epoch), FUTEX_WAIT_PRIVATE, ticket,
+                deadline ? &timeout : nullptr, nullptr, 0);
+        return _epoch.load(std::memory_order_acquire) != ticket;
+#else
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto is_changed = [this, ticket]() { return _epoch.load(std::memory_order_acquire) != ticket; };
+        if (deadline) {
+            return _condition.wait_until(lock, *deadline, is_changed);
+        }
+        _condition.wait(lock, is_changed);
+        return true;
+#endif
+    }
+
+    std::atomic<uint32_t> _epoch{0};
+    std::atomic<uint32_t> _waiters_number{0};
+
+#ifndef __linux__
+    std::mutex _mutex;
+    std::condition_variable _condition;
+#endif
+};
+
+/// Backoff policies of the Queue CAS loops: a Backoff object lives for one operation and Fail is called after every
+/// failed CAS, so contending threads pause instead of hammering head and tail.
+
+/// Retries immediately.
+class NoBackoff {
+public:
+    void Fail() {}
+};
+
+/// Pauses for Min_Spins CPU relax hints after the first failure and doubles the pause after every next one.
+template<uint32_t Min_Spins = 4, uint32_t Max_Spins = 1024>
+class ExponentialBackoff {
+    static_assert(Min_Spins > 0 && Min_Spins <= Max_Spins, "Min_Spins must be in [1, Max_Spins]");
+
+public:
+    void Fail() {
+        for (uint32_t i = 0; i < _spins; ++i) {
+            CpuRelax();
+        }
+        _spins = std::min(_spins * 2, Max_Spins);
+    }
+
+private:
+    uint32_t _spins = Min_Spins;
+};
+
+/// Exponential backoff which starts from half of the pause the previous operation of the thread ended with,
+/// so under steady contention the first retry already waits long enough, and the pause decays to zero
+/// after uncontended operations. The start pause is per thread and shared by all queues.
+template<uint32_t Max_Spins = 1024>
+class AdaptiveBackoff {
+public:
+    AdaptiveBackoff() : _spins(_start_spins) {}
+
+    ~AdaptiveBackoff() {
+        _start_spins = _spins / 2;
+    }
+
+    AdaptiveBackoff(const AdaptiveBackoff&) = delete;
+
+    AdaptiveBackoff& operator=(const AdaptiveBackoff&) = delete;
+
+    void Fail() {
+        for (uint32_t i = 0; i < _spins; ++i) {
+            CpuRelax();
+        }
+        _spins = std::min(std::max(_spins * 2, uint32_t{1}), Max_Spins);
+    }
+
+private:
+    static inline thread_local uint32_t _start_spins = 0;
+
+    uint32_t _spins;
+};
+
+/// Concurrency tags of Queue: the number of threads which may push and pop at the same time.
+/// Queues with a single consumer are specializations which don't pay for the full Michael-Scott protocol.
+class MultiProducerMultiConsumer {
+};
+
+class MultiProducerSingleConsumer {
+};
+
+class SingleProducerSingleConsumer {
+};
+
+/// NodeAllocator is instantiated with the queue node type, see HeapNodeAllocator and NodePool.
+/// Alignment is applied to head, tail, shared statistic counters and hazard pointers to avoid false sharing,
+/// alignof(void*) turns the padding off.
+/// Stats is a statistic policy: SharedStats, ThreadLocalStats or NoStats.
+/// Reclamation is a memory reclamation policy: HazardPointerManager or EpochManager.
+/// Concurrency is one of the tags above, single consumer specializations ignore Max_Threads_Num and Reclamation.
+/// Backoff is a backoff policy of the CAS loops: NoBackoff, ExponentialBackoff or AdaptiveBackoff,
+/// single consumer specializations don't have CAS loops and ignore it.
+template<class T, size_t Max_Threads_Num, template<class> class NodeAllocator = NodePool,
+        size_t Alignment = Cache_Line_Size, class Stats = SharedStats<Alignment>,
+        template<class, size_t, size_t, class, class, size_t> class Reclamation = HazardPointerManager,
+        class Concurrency = MultiProducerMultiConsumer, class Backoff = NoBackoff>
+class Queue {
+    static constexpr size_t _atomic_alignment = Padded_Alignment<std::atomic<size_t>, Alignment>;
+
+public:
+    using ValueType = T;
+    using Statistic = msq::Statistic;
+
+private:
+    class Node {
+    public:
+        template<class... Args>
+        Node(Node* next, std::in_place_t, Args&& ... args) : next(next), value(std::forward<Args>(args)...) {}
+
+        explicit Node(Node* next) : next(next) {}
+
+        /// value isn't destroyed here: sentinel doesn't have it and popped value is destroyed by the popping thread,
+        /// so only nodes which are still in the queue are destroyed with values in ~Queue.
+        ~Node() {}
+
+        std::atomic<Node*> next;
+
+        /// hack for creation sentinel node if user type doesn't have default constructor
+        union {
+            T value;
+        };
+    };
+
+    using Allocator = NodeAllocator<Node>;
+    /// pop_bulk needs 4 hazard pointers: head, tail and two for hand-over-hand walking.
+    static constexpr size_t _operation_hazard_pointers_num = 4;
+    /// a Handle keeps 4 hazard pointers, so operations without it still have 4 in the same thread.
+    using Reclaimer = Reclamation<Node*, 2 * _operation_hazard_pointers_num, Max_Threads_Num, Allocator, Stats,
+            Alignment>;
+    /// HazardPointer, or EpochGuard with EpochManager.
+    using HazardPtr = typename Reclaimer::Guard;
+
+public:
+    Queue() : _reclaimer(_allocator, _stats) {
+        auto* tls = _reclaimer.GetTLS();
+        Node* sentinel = _allocator.New(tls->GetAllocatorCache(), tls->GetCounters(), nullptr);
+        tls->GetCounters().constructed_nodes_number.Add(1);
+        _head_ref.store(sentinel, std::memory_order_relaxed);
+        _tail_ref.store(sentinel, std::memory_order_relaxed);
+    }
+
+    ~Queue() {
+        MSQ_LOG_DEBUG("Queue destructed in thread ", std::this_thread::get_id());
+
+        /// queue must be destroyed in one thread when others have finished working with it.
+        Node* current = _head_ref.load(std::memory_order_relaxed);
+        bool is_sentinel = true;
+        while (current != nullptr) {
+            Node* next = current->next.load(std::memory_order_relaxed);
+            if (!is_sentinel) {
+                current->value.~T();
+            }
+            is_sentinel = false;
+            _allocator.Delete(current);
+            current = next;
+        }
+    }
+
+    void push(const T& value) {
+        emplace(value);
+    }
+
+    void push(T&& value) {
+        emplace(std::move(value));
+    }
+
+    /// Constructs value in the node, so it's neither copied nor moved.
+    template<class... Args>
+    void emplace(Args&& ... args) {
+        HazardPtr hazard_pointer = HazardPtr(&_reclaimer);
+        Emplace(hazard_pointer, std::forward<Args>(args)...);
+    }
+
+    /// Links all values as one chain with a single CAS, so they are pushed successively.
+    /// Values are copied, std::move_iterator moves them.
+    template<class It>
+    void push_range(It first, It last) {
+        if (first == last) {
+            return;
+        }
+        HazardPtr hazard_pointer = HazardPtr(&_reclaimer);
+        PushRange(hazard_pointer, first, last);
+    }
+
+    /// Value is moved to result.
+    bool pop(T& result) {
+        return PopWith([&result](T& value) {
+            result = std::move(value);
+        });
+    }
+
+    std::optional<T> try_pop() {
+        std::optional<T> result;
+        PopWith([&result](T& value) {
+            result.emplace(std::move(value));
+        });
+        return result;
+    }
+
+    /// Detaches up to max_number values with a single head CAS and writes them to out in FIFO order.
+    /// Returns the number of popped values, 0 means the queue was empty.
+    template<class OutIt>
+    size_t pop_bulk(OutIt out, size_t max_number) {
+        if (max_number == 0) {
+            return 0;
+        }
+        HazardPtr hp_head = HazardPtr(&_reclaimer);
+        HazardPtr hp_tail = HazardPtr(&_reclaimer);
+        HazardPtr hp_walk[2] = {HazardPtr(&_reclaimer), HazardPtr(&_reclaimer)};
+        return PopBulk(hp_head, hp_tail, hp_walk[0], hp_walk[1], out, max_number);
+    }
+
+    /// Blocks until a value is popped: spins for a while, then sleeps until push wakes it up.
+    void pop_wait(T& result) {
+        WaitPop([this, &result]() {
+            return pop(result);
+        }, std::nullopt);
+    }
+
+    /// Same as pop_wait, but gives up after timeout, returns false in this case.
+    template<class Rep, class Period>
+    bool pop_for(T& result, const std::chrono::duration<Rep, Period>& timeout) {
+        return WaitPop([this, &result]() {
+            return pop(result);
+        }, std::chrono::steady_clock::now() + timeout);
+    }
+
+    [[nodiscard]] bool empty() {
+        HazardPtr hp_head(&_reclaimer);
+        return IsEmpty(hp_head);
+    }
+
+    /// With ThreadLocalStats counters are summed up on every call, so it's intended for rare metric export.
+    Statistic GetStatistic() {
+        return _stats.Collect(_reclaimer);
+    }
+
+    /// Operations of one thread with hazard pointers which are allocated once, for long-lived worker threads:
+    /// the thread takes a handle and an operation costs only Protect stores, without TLS lookup and allocation
+    /// of hazard pointers. With EpochManager the handle caches only TLS, because an epoch can't be held
+    /// between operations.
+    /// A handle is used only by the thread which has created it and is destroyed before the queue. A thread has
+    /// one handle of a queue at a time: a handle keeps half of the thread hazard pointers, so with a second one
+    /// operations without a handle throw std::logic_error. Handles release exactly the hazard pointers they have
+    /// taken, so they can be destroyed in any order. Operations of the queue without the handle can be mixed
+    /// with it in the same thread. Nodes protected by the last operation of a handle are deleted only after
+    /// its next operation or its destruction.
+    class Handle {
+    public:
+        explicit Handle(Queue& queue)
+                : _queue(queue),
+                  _guards(queue._reclaimer.GetTLS()) {}
+
+        Handle(const Handle&) = delete;
+
+        Handle& operator=(const Handle&) = delete;
+
+        void push(const T& value) {
+            emplace(value);
+        }
+
+        void push(T&& value) {
+            emplace(std::move(value));
+        }
+
+        template<class... Args>
+        void emplace(Args&& ... args) {
+            _guards.Apply([&](HazardPtr& hazard_pointer, HazardPtr&, HazardPtr&, HazardPtr&) {
+                _queue.Emplace(hazard_pointer, std::forward<Args>(args)...);
+            });
+        }
+
+        template<class It>
+        void push_range(It first, It last) {
+            if (first == last) {
+                return;
+            }
+            _guards.Apply([&](HazardPtr& hazard_pointer, HazardPtr&, HazardPtr&, HazardPtr&) {
+                _queue.PushRange(hazard_pointer, first, last);
+            });
+        }
+
+        bool pop(T& result) {
+            return PopWith([&result](T& value) {
+                result = std::move(value);
+            });
+        }
+
+        std::optional<T> try_pop() {
+            std::optional<T> result;
+            PopWith([&result](T& value) {
+                result.emplace(std::move(value));
+            });
+            return result;
+        }
+
+        template<class OutIt>
+        size_t pop_bulk(OutIt out, size_t max_number) {
+            if (max_number == 0) {
+                return 0;
+            }
+            return _guards.Apply([&](HazardPtr& hp_head, HazardPtr& hp_tail, HazardPtr& hp_walk_0,
+                                     HazardPtr& hp_walk_1) {
+                return _queue.PopBulk(hp_head, hp_tail, hp_walk_0, hp_walk_1, out, max_number);
+            });
+        }
+
+        void pop_wait(T& result) {
+            _queue.WaitPop([this, &result]() {
+                return pop(result);
+            }, std::nullopt);
+        }
+
+        template<class Rep, class Period>
+        bool pop_for(T& result, const std::chrono::duration<Rep, Period>& timeout) {
+            return _queue.WaitPop([this, &result]() {
+                return pop(result);
+            }, std::chrono::steady_clock::now() + timeout);
+        }
+
+        [[nodiscard]] bool empty() {
+            return _guards.Apply([this](HazardPtr& hp_head, HazardPtr&, HazardPtr&, HazardPtr&) {
+                return _queue.IsEmpty(hp_head);
+            });
+        }
+
+    private:
+        template<class Consumer>
+        bool PopWith(Consumer consume) {
+            return _guards.Apply([&](HazardPtr& hp_head, HazardPtr& hp_head_next, HazardPtr& hp_tail, HazardPtr&) {
+                return _queue.Pop(hp_head, hp_head_next, hp_tail, consume);
+            });
+        }
+
+        Queue& _queue;
+        CachedGuards<HazardPtr, _operation_hazard_pointers_num> _guards;
+    };
+
+    /// Handle of the calling thread, see Handle.
+    Handle GetHandle() {
+        return Handle(*this);
+    }
+
+private:
+    static constexpr int _spin_iterations_before_wait = 64;
+
+    template<class... Args>
+    void Emplace(HazardPtr& hazard_pointer, Args&& ... args) {
+        MSQ_TRACE_START(trace_start);
+        int loop_times_before_success = 0;
+        Backoff backoff;
+
+        auto& counters = hazard_pointer.GetTLS()->GetCounters();
+        Node* new_node = _allocator.New(hazard_pointer.GetTLS()->GetAllocatorCache(), counters, nullptr,
+                                        std::in_place, std::forward<Args>(args)...);
+        counters.constructed_nodes_number.Add(1);
+
+        while (true) {
+            ++loop_times_before_success;
+
+            Node* tail = hazard_pointer.Protect(_tail_ref);
+            Node* tail_next = tail->next.load(
+                    std::memory_order_acquire); /// tail_next can't change if tail hasn't changed, so we shouldn't protect it
+
+            Node* cas_nullptr = nullptr;
+            if (tail_next != nullptr) {
+                _tail_ref.compare_exchange_weak(tail, tail_next, std::memory_order_release, std::memory_order_relaxed);
+            }
+            /// seq_cst pairs with the fence in EventCount::PrepareWait, it's the same instruction on x86.
+            else if (tail->next.compare_exchange_strong(cas_nullptr, new_node, std::memory_order_seq_cst,
+                                                        std::memory_order_relaxed)) {
+                _tail_ref.compare_exchange_weak(tail, new_node, std::memory_order_release, std::memory_order_relaxed);
+                _pop_event.Notify(1);
+
+                counters.AddPushLoopIterations(loop_times_before_success);
+                counters.successful_push_number.Add(1);
+                MSQ_TRACE_EVENT(Trace_Push, trace_start, loop_times_before_success);
+                return;
+            }
+            else {
+                /// another producer has linked its node first.
+                MSQ_TRACE_EVENT(Trace_Push_Cas_Failure, trace_start, loop_times_before_success);
+                backoff.Fail();
+            }
+        }
+    }
+
+    /// first != last.
+    template<class It>
+    void PushRange(HazardPtr& hazard_pointer, It first, It last) {
+        MSQ_TRACE_START(trace_start);
+        int loop_times_before_success = 0;
+        Backoff backoff;
+        size_t values_number = 0;
+
+        auto& cache = hazard_pointer.GetTLS()->GetAllocatorCache();
+        auto& counters = hazard_pointer.GetTLS()->GetCounters();
+
+        Node* chain_first = _allocator.New(cache, counters, nullptr, std::in_place, *first);
+        Node* chain_last = chain_first;
+        ++values_number;
+        try {
+            for (++first; first != last; ++first) {
+                Node* new_node = _allocator.New(cache, counters, nullptr, std::in_place, *first);
+                chain_last->next.store(new_node, std::memory_order_relaxed);
+                chain_last = new_node;
+                ++values_number;
+            }
+        }
+        catch (...) {
+            /// the chain isn't linked yet, so a throwing constructor leaves the queue unchanged.
+            Node* current = chain_first;
+            while (current != nullptr) {
+                Node* next = current->next.load(std::memory_order_relaxed);
+                current->value.~T();
+                _allocator.Delete(cache, current);
+                current = next;
+            }
+            throw;
+        }
+        counters.constructed_nodes_number.Add(values_number);
+
+        while (true) {
+            ++loop_times_before_success;
+
+            Node* tail = hazard_pointer.Protect(_tail_ref);
+            Node* tail_next = tail->next.load(std::memory_order_acquire);
+
+            Node* cas_nullptr = nullptr;
+            if (tail_next != nullptr) {
+                _tail_ref.compare_exchange_weak(tail, tail_next, std::memory_order_release, std::memory_order_relaxed);
+            }
+            else if (tail->next.compare_exchange_strong(cas_nullptr, chain_first, std::memory_order_seq_cst,
+                                                        std::memory_order_relaxed)) {
+                /// if it fails, other threads move tail through the chain node by node.
+                _tail_ref.compare_exchange_weak(tail, chain_last, std::memory_order_release,
+                                                std::memory_order_relaxed);
+                _pop_event.Notify(values_number);
+
+                counters.AddPushLoopIterations(loop_times_before_success);
+                counters.successful_push_number.Add(values_number);
+                MSQ_TRACE_EVENT(Trace_Push, trace_start, loop_times_before_success);
+                return;
+            }
+            else {
+                MSQ_TRACE_EVENT(Trace_Push_Cas_Failure, trace_start, loop_times_before_success);
+                backoff.Fail();
+            }
+        }
+    }
+
+    /// hp_tail: new head can't go beyond tail, hp_walk: hand-over-hand walking, max_number > 0.
+    template<class OutIt>
+    size_t PopBulk(HazardPtr& hp_head, HazardPtr& hp_tail, HazardPtr& hp_walk_0, HazardPtr& hp_walk_1, OutIt out,
+                   size_t max_number) {
+        MSQ_TRACE_START(trace_start);
+        int loop_times_before_success = 0;
+        Backoff backoff;
+
+        HazardPtr* hp_walk[2] = {&hp_walk_0, &hp_walk_1};
+        auto& counters = hp_head.GetTLS()->GetCounters();
+
+        while (true) {
+            ++loop_times_before_success;
+
+            Node* head = hp_head.Protect(_head_ref);
+            Node* tail = hp_tail.Protect(_tail_ref);
+
+            /// hand-over-hand walk, every next node is protected before the previous one is released.
+            /// Nodes after head can't be retired while head is unchanged, so head is checked after each step.
+            Node* new_head = head;
+            size_t values_number = 0;
+            bool is_head_changed = false;
+            while (values_number < max_number) {
+                if (new_head == tail && values_number != 0) {
+                    break;
+                }
+                Node* next = hp_walk[values_number % 2]->Protect(new_head->next);
+                if (_head_ref.load(std::memory_order_acquire) != head) {
+                    is_head_changed = true;
+                    break;
+                }
+                if (next == nullptr) {
+                    break;
+                }
+                if (new_head == tail) {
+                    /// tail lags behind, help it and start again.
+                    _tail_ref.compare_exchange_weak(tail, next, std::memory_order_release, std::memory_order_relaxed);
+                    is_head_changed = true;
+                    break;
+                }
+                new_head = next;
+                ++values_number;
+            }
+
+            if (is_head_changed) {
+                MSQ_TRACE_EVENT(Trace_Pop_Cas_Failure, trace_start, loop_times_before_success);
+                backoff.Fail();
+                continue;
+            }
+            if (values_number == 0) {
+                counters.empty_pop_number.Add(1);
+                MSQ_TRACE_EVENT(Trace_Empty_Pop, trace_start, loop_times_before_success);
+                return 0;
+            }
+
+            if (_head_ref.compare_exchange_strong(head, new_head, std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+                /// detached nodes between head and new_head are retired only by this thread, values are moved out,
+                /// so they can be read without protection, new_head itself is still protected.
+                Node* current = head;
+                for (size_t i = 0; i < values_number; ++i) {
+                    Node* next = current->next.load(std::memory_order_acquire);
+                    *out = std::move(next->value);
+                    ++out;
+                    next->value.~T();
+                    hp_head.Retire(current);
+                    current = next;
+                }
+
+                counters.AddPopLoopIterations(loop_times_before_success);
+                counters.successful_pop_number.Add(values_number);
+                MSQ_TRACE_EVENT(Trace_Pop, trace_start, loop_times_before_success);
+                return values_number;
+            }
+            MSQ_TRACE_EVENT(Trace_Pop_Cas_Failure, trace_start, loop_times_before_success);
+            backoff.Fail();
+        }
+    }
+
+    bool IsEmpty(HazardPtr& hp_head) {
+        Node* head = hp_head.Protect(_head_ref);
+
+        return head->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+    template<class Consumer>
+    bool PopWith(Consumer consume) {
+        HazardPtr hp_head = HazardPtr(&_reclaimer);      /// for safe "_head_ref.compare_exchange(head, head_next)"
+        HazardPtr hp_head_next = HazardPtr(&_reclaimer); /// for safe "result = head_next->value;"
+        HazardPtr hp_tail = HazardPtr(&_reclaimer);      /// for safe "_tail_ref.compare_exchange(tail, head_next)"
+        return Pop(hp_head, hp_head_next, hp_tail, consume);
+    }
+
+    template<class Consumer>
+    bool Pop(HazardPtr& hp_head, HazardPtr& hp_head_next, HazardPtr& hp_tail, Consumer& consume) {
+        MSQ_TRACE_START(trace_start);
+        int loop_times_before_success = 0;
+        Backoff backoff;
+
+        auto& counters = hp_head.GetTLS()->GetCounters();
+
+        while (true) {
+            ++loop_times_before_success;
+
+            Node* head = hp_head.Protect(_head_ref);
+            Node* tail = hp_tail.Protect(_tail_ref);
+            Node* head_next = hp_head_next.Protect(head->next);
+
+            if (head == tail) {
+                if (head_next == nullptr) {
+                    counters.empty_pop_number.Add(1);
+                    MSQ_TRACE_EVENT(Trace_Empty_Pop, trace_start, loop_times_before_success);
+                    return false;
+                }
+                _tail_ref.compare_exchange_weak(tail, head_next, std::memory_order_release, std::memory_order_relaxed);
+            }
+            else {
+                if (_head_ref.compare_exchange_strong(head, head_next, std::memory_order_release,
+                                                      std::memory_order_relaxed)) {
+                    /// only the thread which moved head owns the value, head_next becomes the sentinel.
+                    consume(head_next->value);
+                    head_next->value.~T();
+
+                    hp_head.Retire();
+
+                    counters.AddPopLoopIterations(loop_times_before_success);
+                    counters.successful_pop_number.Add(1);
+                    MSQ_TRACE_EVENT(Trace_Pop, trace_start, loop_times_before_success);
+                    return true;
+                }
+                /// another consumer has taken head_next first.
+                MSQ_TRACE_EVENT(Trace_Pop_Cas_Failure, trace_start, loop_times_before_success);
+                backoff.Fail();
+            }
+        }
+    }
+
+    /// try_pop is pop of the queue or of a Handle.
+    template<class TryPop>
+    bool WaitPop(TryPop try_pop, const std::optional<std::chrono::steady_clock::time_point>& deadline) {
+        for (int i = 0; i < _spin_iterations_before_wait; ++i) {
+            if (try_pop()) {
+                return true;
+            }
+            CpuRelax();
+        }
+
+        while (true) {
+            /// check after registration: either push sees the waiter, or this pop sees pushed value.
+            uint32_t ticket = _pop_event.PrepareWait();
+            if (try_pop()) {
+                _pop_event.CancelWait();
+                return true;
+            }
+            if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+                _pop_event.CancelWait();
+                return false;
+            }
+            _pop_event.Wait(ticket, deadline);
+        }
+    }
+
+    Stats _stats;
+    Allocator _allocator;
+    Reclaimer _reclaimer;
+
+    /// consumers write head and producers write tail, so they are in different cache lines.
+    alignas(_atomic_alignment) std::atomic<Node*> _head_ref{nullptr};
+    alignas(_atomic_alignment) std::atomic<Node*> _tail_ref{nullptr};
+
+    /// push reads it on every call, so it doesn't share a cache line with tail.
+    alignas(_atomic_alignment) EventCount _pop_event;
+};
+
+/// Queue for one producer and one consumer thread at a time, push and pop are wait-free and have no CAS.
+/// Consumed nodes stay in the list before head and the producer reuses them, so the consumer never deletes nodes
+/// and the allocator is called only when all nodes are in use, constructed_nodes_number counts allocations.
+template<class T, size_t Max_Threads_Num, template<class> class NodeAllocator, size_t Alignment, class Stats,
+        template<class, size_t, size_t, class, class, size_t> class Reclamation, class Backoff>
+class Queue<T, Max_Threads_Num, NodeAllocator, Alignment, Stats, Reclamation, SingleProducerSingleConsumer, Backoff> {
+    static constexpr size_t _atomic_alignment = Padded_Alignment<std::atomic<size_t>, Alignment>;
+
+public:
+    using Statistic = msq::Statistic;
+
+private:
+    class Node {
+    public:
+        template<class... Args>
+        Node(Node* next, std::in_place_t, Args&& ... args) : next(next), value(std::forward<Args>(args)...) {}
+
+        explicit Node(Node* next) : next(next) {}
+
+        /// value is destroyed by the consumer, so only nodes after head are destroyed with values in ~Queue.
+        ~Node() {}
+
+        std::atomic<Node*> next;
+
+        union {
+            T value;
+        };
+    };
+
+    using Allocator = NodeAllocator<Node>;
+    using Manager = ThreadDataManager<Allocator, Stats>;
+
+public:
+    Queue() : _manager(_allocator, _stats) {
+        auto* tls = _manager.GetTLS();
+        Node* sentinel = _allocator.New(tls->GetAllocatorCache(), tls->GetCounters(), nullptr);
+        tls->GetCounters().constructed_nodes_number.Add(1);
+        _head_ref.store(sentinel, std::memory_order_relaxed);
+        _tail = sentinel;
+        _first_consumed = sentinel;
+        _head_copy = sentinel;
+    }
+
+    ~Queue() {
+        MSQ_LOG_DEBUG("SPSC Queue destructed in thread ", std::this_thread::get_id());
+
+        /// queue must be destroyed in one thread when others have finished working with it.
+        Node* head = _head_ref.load(std::memory_order_relaxed);
+        Node* current = _first_consumed;
+        bool has_value = false;
+        while (current != nullptr) {
+            Node* next = current->next.load(std::memory_order_relaxed);
+            if (has_value) {
+                current->value.~T();
+            }
+            if (current == head) {
+                has_value = true;
+            }
+            _allocator.Delete(current);
+            current = next;
+        }
+    }
+
+    void push(const T& value) {
+        emplace(value);
+    }
+
+    void push(T&& value) {
+        emplace(std::move(value));
+    }
+
+    /// Constructs value in the node, so it's neither copied nor moved.
+    template<class... Args>
+    void emplace(Args&& ... args) {
+        auto* tls = _manager.GetTLS();
+        auto& counters = tls->GetCounters();
+
+        Node* new_node;
+        if (HasConsumedNode()) {
+            /// the node is taken from the list only after the value is constructed, so a throwing constructor
+            /// leaves it there.
+            new_node = _first_consumed;
+            new(&new_node->value) T(std::forward<Args>(args)...);
+            _first_consumed = new_node->next.load(std::memory_order_relaxed);
+            new_node->next.store(nullptr, std::memory_order_relaxed);
+        }
+        else {
+            new_node = _allocator.New(tls->GetAllocatorCache(), counters, nullptr, std::in_place,
+                                      std::forward<Args>(args)...);
+            counters.constructed_nodes_number.Add(1);
+        }
+
+        /// seq_cst pairs with the fence in EventCount::PrepareWait, it's the same instruction on x86.
+        _tail->next.store(new_node, std::memory_order_seq_cst);
+        _tail = new_node;
+        _pop_event.Notify(1);
+
+        counters.AddPushLoopIterations(1);
+        counters.successful_push_number.Add(1);
+    }
+
+    /// Value is moved to result.
+    bool pop(T& result) {
+        return PopWith([&result](T& value) {
+            result = std::move(value);
+        });
+    }
+
+    std::optional<T> try_pop() {
+        std::optional<T> result;
+        PopWith([&result](T& value) {
+            result.emplace(std::move(value));
+        });
+        return result;
+    }
+
+    /// Blocks until a value is popped: spins for a while, then sleeps until push wakes it up.
+    void pop_wait(T& result) {
+        WaitPop(result, std::nullopt);
+    }
+
+    /// Same as pop_wait, but gives up after timeout, returns false in this case.
+    template<class Rep, class Period>
+    bool pop_for(T& result, const std::chrono::duration<Rep, Period>& timeout) {
+        return WaitPop(result, std::chrono::steady_clock::now() + timeout);
+    }
+
+    /// Nodes are deleted only in ~Queue, so it's safe in any thread.
+    [[nodiscard]] bool empty() {
+        Node* head = _head_ref.load(std::memory_order_acquire);
+        return head->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+    /// With ThreadLocalStats counters are summed up on every call, so it's intended for rare metric export.
+    Statistic GetStatistic() {
+        return _stats.Collect(_manager);
+    }
+
+private:
+    static constexpr int _spin_iterations_before_wait = 64;
+
+    /// Nodes from _first_consumed to _head_copy were consumed, head is reloaded only when they run out.
+    bool HasConsumedNode() {
+        if (_first_consumed != _head_copy) {
+            return true;
+        }
+        /// acquire: the consumer has destroyed the values of the nodes before head.
+        _head_copy = _head_ref.load(std::memory_order_acquire);
+        return _first_consumed != _head_copy;
+    }
+
+    template<class Consumer>
+    bool PopWith(Consumer consume) {
+        auto& counters = _manager.GetTLS()->GetCounters();
+
+        Node* head = _head_ref.load(std::memory_order_relaxed);
+        Node* head_next = head->next.load(std::memory_order_acquire);
+        if (head_next == nullptr) {
+            counters.empty_pop_number.Add(1);
+            return false;
+        }
+
+        consume(head_next->value);
+        head_next->value.~T();
+        /// release: head is reused by the producer after this store.
+        _head_ref.store(head_next, std::memory_order_release);
+
+        counters.AddPopLoopIterations(1);
+        counters.successful_pop_number.Add(1);
+        return true;
+    }
+
+    bool WaitPop(T& result, const std::optional<std::chrono::steady_clock::time_point>& deadline) {
+        for (int i = 0; i < _spin_iterations_before_wait; ++i) {
+            if (pop(result)) {
+                return true;
+            }
+            CpuRelax();
+        }
+
+        while (true) {
+            /// check after registration: either push sees the waiter, or this pop sees pushed value.
+            uint32_t ticket = _pop_event.PrepareWait();
+            if (pop(result)) {
+                _pop_event.CancelWait();
+                return true;
+            }
+            if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+                _pop_event.CancelWait();
+                return false;
+            }
+            _pop_event.Wait(ticket, deadline);
+        }
+    }
+
+    Stats _stats;
+    Allocator _allocator;
+    Manager _manager;
+
+    /// the consumer writes head, the rest is used only by the producer, so they are in different cache lines.
+    alignas(_atomic_alignment) std::atomic<Node*> _head_ref{nullptr};
+
+    alignas(_atomic_alignment) Node* _tail = nullptr;
+    Node* _first_consumed = nullptr;
+    Node* _head_copy = nullptr;
+
+    alignas(_atomic_alignment) EventCount _pop_event;
+};
+
+/// Queue for many producers and one consumer thread at a time, Dmitry Vyukov's MPSC algorithm: push is one exchange
+/// of tail and a store to the next of the previous tail, pop is a plain read of next, so nothing is retried.
+/// Only the consumer deletes nodes and producers don't touch a node after linking it, so there are no hazard
+/// pointers. Between the exchange and the store the queue ends at the previous tail, so pop of the consumer
+/// may see it empty until the producer finishes, pop isn't lock-free in this sense.
+/// pop, try_pop, pop_wait, pop_for and empty must be called only by the consumer.
+template<class T, size_t Max_Threads_Num, template<class> class NodeAllocator, size_t Alignment, class Stats,
+        template<class, size_t, size_t, class, class, size_t> class Reclamation, class Backoff>
+class Queue<T, Max_Threads_Num, NodeAllocator, Alignment, Stats, Reclamation, MultiProducerSingleConsumer, Backoff> {
+    static constexpr size_t _atomic_alignment = Padded_Alignment<std::atomic<size_t>, Alignment>;
+
+public:
+    using Statistic = msq::Statistic;
+
+private:
+    class Node {
+    public:
+        template<class... Args>
+        Node(Node* next, std::in_place_t, Args&& ... args) : next(next), value(std::forward<Args>(args)...) {}
+
+        explicit Node(Node* next) : next(next) {}
+
+        /// value isn't destroyed here: sentinel doesn't have it and popped value is destroyed by the consumer.
+        ~Node() {}
+
+        std::atomic<Node*> next;
+
+        union {
+            T value;
+        };
+    };
+
+    using Allocator = NodeAllocator<Node>;
+    using Manager = ThreadDataManager<Allocator, Stats>;
+
+public:
+    Queue() : _manager(_allocator, _stats) {
+        auto* tls = _manager.GetTLS();
+        Node* sentinel = _allocator.New(tls->GetAllocatorCache(), tls->GetCounters(), nullptr);
+        tls->GetCounters().constructed_nodes_number.Add(1);
+        _head = sentinel;
+        _tail_ref.store(sentinel, std::memory_order_relaxed);
+    }
+
+    ~Queue() {
+        MSQ_LOG_DEBUG("MPSC Queue destructed in thread ", std::this_thread::get_id());
+
+        /// queue must be destroyed in one thread when others have finished working with it.
+        Node* current = _head;
+        bool is_sentinel = true;
+        while (current != nullptr) {
+            Node* next = current->next.load(std::memory_order_relaxed);
+            if (!is_sentinel) {
+                current->value.~T();
+            }
+            is_sentinel = false;
+            _allocator.Delete(current);
+            current = next;
+        }
+    }
+
+    void push(const T& value) {
+        emplace(value);
+    }
+
+    void push(T&& value) {
+        emplace(std::move(value));
+    }
+
+    /// Constructs value in the node, so it's neither copied nor moved.
+    template<class... Args>
+    void emplace(Args&& ... args) {
+        auto* tls = _manager.GetTLS();
+        auto& counters = tls->GetCounters();
+        Node* new_node = _allocator.New(tls->GetAllocatorCache(), counters, nullptr, std::in_place,
+                                        std::forward<Args>(args)...);
+        counters.constructed_nodes_number.Add(1);
+
+        /// acq_rel: next of the previous tail was initialized by its producer.
+        Node* prev_tail = _tail_ref.exchange(new_node, std::memory_order_acq_rel);
+        /// seq_cst pairs with the fence in EventCount::PrepareWait, it's the same instruction on x86.
+        prev_tail->next.store(new_node, std::memory_order_seq_cst);
+        _pop_event.Notify(1);
+
+        counters.AddPushLoopIterations(1);
+        counters.successful_push_number.Add(1);
+    }
+
+    /// Value is moved to result.
+    bool pop(T& result) {
+        return PopWith([&result](T& value) {
+            result = std::move(value);
+        });
+    }
+
+    std::optional<T> try_pop() {
+        std::optional<T> result;
+        PopWith([&result](T& value) {
+            result.emplace(std::move(value));
+        });
+        return result;
+    }
+
+    /// Blocks until a value is popped: spins for a while, then sleeps until push wakes it up.
+    void pop_wait(T& result) {
+        WaitPop(result, std::nullopt);
+    }
+
+    /// Same as pop_wait, but gives up after timeout, returns false in this case.
+    template<class Rep, class Period>
+    bool pop_for(T& result, const std::chrono::duration<Rep, Period>& timeout) {
+        return WaitPop(result, std::chrono::steady_clock::now() + timeout);
+    }
+
+    [[nodiscard]] bool empty() {
+        return _head->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+    /// With ThreadLocalStats counters are summed up on every call, so it's intended for rare metric export.
+    Statistic GetStatistic() {
+        return _stats.Collect(_manager);
+    }
+
+private:
+    static constexpr int _spin_iterations_before_wait = 64;
+
+    template<class Consumer>
+    bool PopWith(Consumer consume) {
+        auto* tls = _manager.GetTLS();
+        auto& counters = tls->GetCounters();
+
+        Node* head_next = _head->next.load(std::memory_order_acquire);
+        if (head_next == nullptr) {
+            counters.empty_pop_number.Add(1);
+            return false;
+        }
+
+        consume(head_next->value);
+        head_next->value.~T();
+        /// producers don't touch the old sentinel any more: its next has been stored.
+        _allocator.Delete(tls->GetAllocatorCache(), _head);
+        _head = head_next;
+
+        counters.destructed_nodes_number.Add(1);
+        counters.AddPopLoopIterations(1);
+        counters.successful_pop_number.Add(1);
+        return true;
+    }
+
+    bool WaitPop(T& result, const std::optional<std::chrono::steady_clock::time_point>& deadline) {
+        for (int i = 0; i < _spin_iterations_before_wait; ++i) {
+            if (pop(result)) {
+                return true;
+            }
+            CpuRelax();
+        }
+
+        while (true) {
+            /// check after registration: either push sees the waiter, or this pop sees pushed value.
+            uint32_t ticket = _pop_event.PrepareWait();
+            if (pop(result)) {
+                _pop_event.CancelWait();
+                return true;
+            }
+            if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+                _pop_event.CancelWait();
+                return false;
+            }
+            _pop_event.Wait(ticket, deadline);
+        }
+    }
+
+    Stats _stats;
+    Allocator _allocator;
+    Manager _manager;
+
+    /// head is used only by the consumer, producers exchange tail, so they are in different cache lines.
+    alignas(_atomic_alignment) Node* _head = nullptr;
+    alignas(_atomic_alignment) std::atomic<Node*> _tail_ref{nullptr};
+
+    alignas(_atomic_alignment) EventCount _pop_event;
+};
+
+/// Queue specializations for a single consumer, Max_Threads_Num and Reclamation aren't needed for them.
+template<class T, template<class> class NodeAllocator = NodePool, size_t Alignment = Cache_Line_Size,
+        class Stats = SharedStats<Alignment>>
+using SpscQueue = Queue<T, Dynamic_Threads_Num, NodeAllocator, Alignment, Stats, HazardPointerManager,
+        SingleProducerSingleConsumer>;
+
+template<class T, template<class> class NodeAllocator = NodePool, size_t Alignment = Cache_Line_Size,
+        class Stats = SharedStats<Alignment>>
+using MpscQueue = Queue<T, Dynamic_Threads_Num, NodeAllocator, Alignment, Stats, HazardPointerManager,
+        MultiProducerSingleConsumer>;
+
+/// Unrolled variant of Queue: every node is a segment of Segment_Size slots, producers and consumers take slots
+/// with fetch-and-add of the segment indices, Michael-Scott CAS-linking is needed only when a segment is full.
+/// Segments are reclaimed by the Reclamation policy, so reclamation runs once per Segment_Size values.
+/// A consumer which takes a slot before its producer has written it marks the slot as taken, the producer tries
+/// the next slot then, so both operations stay lock-free.
+/// FIFO order is the order of the enqueue indices, values are moved into the slots, so T must be movable.
+/// Template parameters after Segment_Size are the same as in Queue, nodes of NodeAllocator are segments.
+template<class T, size_t Max_Threads_Num, size_t Segment_Size = 64, template<class> class NodeAllocator = NodePool,
+        size_t Alignment = Cache_Line_Size, class Stats = SharedStats<Alignment>,
+        template<class, size_t, size_t, class, class, size_t> class Reclamation = HazardPointerManager>
+class SegmentedQueue {
+    static_assert(Segment_Size > 0, "Segment must have at least one slot");
+
+    static constexpr size_t _atomic_alignment = Padded_Alignment<std::atomic<size_t>, Alignment>;
+
+public:
+    using Statistic = msq::Statistic;
+
+private:
+    enum SlotState : uint8_t {
+        Slot_Empty,
+        Slot_Full,
+        Slot_Taken
+    };
+
+    class Slot {
+    public:
+        T* GetValue() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+
+        std::atomic<uint8_t> state{Slot_Empty};
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    class Segment {
+    public:
+        /// values aren't destroyed here: popped values are destroyed by the popping thread, and values
+        /// which are still in the queue are destroyed in ~SegmentedQueue.
+        Segment() = default;
+
+        /// producers and consumers increment different indices, so they are in different cache lines.
+        alignas(_atomic_alignment) std::atomic<size_t> enqueue_index{0};
+        alignas(_atomic_alignment) std::atomic<size_t> dequeue_index{0};
+        alignas(_atomic_alignment) std::atomic<Segment*> next{nullptr};
+        std::array<Slot, Segment_Size> slots;
+    };
+
+    using Allocator = NodeAllocator<Segment>;
+    /// an operation protects only the segment it works with.
+    using Reclaimer = Reclamation<Segment*, 1, Max_Threads_Num, Allocator, Stats, Alignment>;
+    using HazardPtr = typename Reclaimer::Guard;
+
+public:
+    SegmentedQueue() : _reclaimer(_allocator, _stats) {
+        auto* tls = _reclaimer.GetTLS();
+        Segment* first = _allocator.New(tls->GetAllocatorCache(), tls->GetCounters());
+        tls->GetCounters().constructed_nodes_number.Add(1);
+        _head_ref.store(first, std::memory_order_relaxed);
+        _tail_ref.store(first, std::memory_order_relaxed);
+    }
+
+    ~SegmentedQueue() {
+        MSQ_LOG_DEBUG("SegmentedQueue destructed in thread ", std::this_thread::get_id());
+
+        /// queue must be destroyed in one thread when others have finished working with it.
+        Segment* current = _head_ref.load(std::memory_order_relaxed);
+        while (current != nullptr) {
+            Segment* next = current->next.load(std::memory_order_relaxed);
+            for (Slot& slot: current->slots) {
+                if (slot.state.load(std::memory_order_relaxed) == Slot_Full) {
+                    slot.GetValue()->~T();
+                }
+            }
+            _allocator.Delete(current);
+            current = next;
+        }
+    }
+
+    void push(const T& value) {
+        emplace(value);
+    }
+
+    void push(T&& value) {
+        emplace(std::move(value));
+    }
+
+    /// Value is constructed once and moved into the slot, it's moved again only if a consumer has taken the slot.
+    template<class... Args>
+    void emplace(Args&& ... args) {
+        int loop_times_before_success = 0;
+
+        HazardPtr hazard_pointer = HazardPtr(&_reclaimer);
+        auto& counters = hazard_pointer.GetTLS()->GetCounters();
+
+        alignas(T) unsigned char pending_storage[sizeof(T)];
+        T* pending = new(pending_storage) T(std::forward<Args>(args)...);
+
+        while (true) {
+            ++loop_times_before_success;
+
+            Segment* tail = hazard_pointer.Protect(_tail_ref);
+            size_t index = tail->enqueue_index.fetch_add(1, std::memory_order_relaxed);
+
+            if (index < Segment_Size) {
+                Slot& slot = tail->slots[index];
+                T* stored = new(slot.storage) T(std::move(*pending));
+                pending->~T();
+
+                uint8_t expected = Slot_Empty;
+                if (slot.state.compare_exchange_strong(expected, Slot_Full, std::memory_order_release,
+                                                       std::memory_order_relaxed)) {
+                    counters.AddPushLoopIterations(loop_times_before_success);
+                    counters.successful_push_number.Add(1);
+                    return;
+                }
+                /// the slot is taken by a consumer which won't read it, the value is still ours.
+                pending = new(pending_storage) T(std::move(*stored));
+                stored->~T();
+                continue;
+            }
+
+            /// segment is full, link a new one like Queue links a node.
+            if (tail != _tail_ref.load(std::memory_order_acquire)) {
+                continue;
+            }
+            Segment* tail_next = tail->next.load(std::memory_order_acquire);
+            if (tail_next != nullptr) {
+                _tail_ref.compare_exchange_weak(tail, tail_next, std::memory_order_release, std::memory_order_relaxed);
+                continue;
+            }
+
+            Segment* new_segment = _allocator.New(hazard_pointer.GetTLS()->GetAllocatorCache(), counters);
+            Slot& first_slot = new_segment->slots[0];
+            T* stored = new(first_slot.storage) T(std::move(*pending));
+            pending->~T();
+            first_slot.state.store(Slot_Full, std::memory_order_relaxed);
+            new_segment->enqueue_index.store(1, std::memory_order_relaxed);
+
+            Segment* cas_nullptr = nullptr;
+            if (tail->next.compare_exchange_strong(cas_nullptr, new_segment, std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+                _tail_ref.compare_exchange_weak(tail, new_segment, std::memory_order_release,
+                                                std::memory_order_relaxed);
+
+                counters.constructed_nodes_number.Add(1);
+                counters.AddPushLoopIterations(loop_times_before_success);
+                counters.successful_push_number.Add(1);
+                return;
+            }
+            /// another producer has linked its segment, ours was never visible to other threads.
+            pending = new(pending_storage) T(std::move(*stored));
+            stored->~T();
+            _allocator.Delete(hazard_pointer.GetTLS()->GetAllocatorCache(), new_segment);
+        }
+    }
+
+    /// Value is moved to result.
+    bool pop(T& result) {
+        return PopWith([&result](T& value) {
+            result = std::move(value);
+        });
+    }
+
+    std::optional<T> try_pop() {
+        std::optional<T> result;
+        PopWith([&result](T& value) {
+            result.emplace(std::move(value));
+        });
+        return result;
+    }
+
+    /// Slots which are reserved by producers, but not written yet, are counted as values.
+    [[nodiscard]] bool empty() {
+        HazardPtr hp_head(&_reclaimer);
+        Segment* head = hp_head.Protect(_head_ref);
+
+        return IsDrained(head) && head->next.load(std::memory_order_acquire) == nullptr;
+    }
+
+    /// With ThreadLocalStats counters are summed up on every call, so it's intended for rare metric export.
+    Statistic GetStatistic() {
+        return _stats.Collect(_reclaimer);
+    }
+
+private:
+    static bool IsDrained(Segment* segment) {
+        size_t dequeue_index = segment->dequeue_index.load(std::memory_order_acquire);
+        return dequeue_index >= Segment_Size ||
+               dequeue_index >= segment->enqueue_index.load(std::memory_order_acquire);
+    }
+
+    template<class Consumer>
+    bool PopWith(Consumer consume) {
+        int loop_times_before_success = 0;
+
+        HazardPtr hp_head = HazardPtr(&_reclaimer);
+        auto& counters = hp_head.GetTLS()->GetCounters();
+
+        while (true) {
+            ++loop_times_before_success;
+
+            Segment* head = hp_head.Protect(_head_ref);
+            /// fast check, so empty pops don't increment dequeue_index of the last segment.
+            if (IsDrained(head) && head->next.load(std::memory_order_acquire) == nullptr) {
+                counters.empty_pop_number.Add(1);
+                return false;
+            }
+
+            size_t index = head->dequeue_index.fetch_add(1, std::memory_order_relaxed);
+            if (index < Segment_Size) {
+                Slot& slot = head->slots[index];
+                if (slot.state.exchange(Slot_Taken, std::memory_order_acquire) == Slot_Full) {
+                    T* value = slot.GetValue();
+                    consume(*value);
+                    value->~T();
+
+                    counters.AddPopLoopIterations(loop_times_before_success);
+                    counters.successful_pop_number.Add(1);
+                    return true;
+                }
+                /// producer hasn't written the slot yet, it will see the mark and use another slot.
+                continue;
+            }
+
+            /// all slots of the segment are taken, move head to the next one.
+            Segment* head_next = head->next.load(std::memory_order_acquire);
+            if (head_next == nullptr) {
+                counters.empty_pop_number.Add(1);
+                return false;
+            }
+            /// head mustn't overtake tail, otherwise producers could protect the retired segment.
+            Segment* tail = _tail_ref.load(std::memory_order_acquire);
+            if (tail == head) {
+                _tail_ref.compare_exchange_weak(tail, head_next, std::memory_order_release, std::memory_order_relaxed);
+                continue;
+            }
+            if (_head_ref.compare_exchange_strong(head, head_next, std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+                hp_head.Retire();
+            }
+        }
+    }
+
+    Stats _stats;
+    Allocator _allocator;
+    Reclaimer _reclaimer;
+
+    /// consumers write head and producers write tail, so they are in different cache lines.
+    alignas(_atomic_alignment) std::atomic<Segment*> _head_ref{nullptr};
+    alignas(_atomic_alignment) std::atomic<Segment*> _tail_ref{nullptr};
+};
+
+/// Bounded queue on a preallocated ring of Capacity cells, Dmitry Vyukov's MPMC algorithm: the sequence number
+/// of a cell tells whether it's free for the push of the current lap or filled for the pop of it, so push and pop
+/// take a cell with one CAS of their position and nothing is allocated or reclaimed.
+/// try_push returns false when the queue is full, push and push_wait sleep until a consumer frees a cell,
+/// so fast producers are throttled by consumers instead of growing the queue.
+/// Values are moved into the cells, so T must be nothrow movable: a reserved cell can't be given back.
+template<class T, size_t Capacity, size_t Alignment = Cache_Line_Size>
+class BoundedQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    static_assert(std::is_nothrow_move_constructible_v<T>, "Value is moved into a reserved cell, it mustn't throw");
+
+    static constexpr size_t _atomic_alignment = Padded_Alignment<std::atomic<size_t>, Alignment>;
+    static constexpr size_t _index_mask = Capacity - 1;
+
+    class Cell {
+    public:
+        T* GetValue() {
+            return std::launder(reinterpret_cast<T*>(storage));
+        }
+
+        std::atomic<size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+public:
+    BoundedQueue() : _cells(std::make_unique<Cell[]>(Capacity)) {
+        for (size_t i = 0; i < Capacity; ++i) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~BoundedQueue() {
+        MSQ_LOG_DEBUG("BoundedQueue destructed in thread ", std::this_thread::get_id());
+
+        /// queue must be destroyed in one thread when others have finished working with it.
+        size_t end = _enqueue_position.load(std::memory_order_relaxed);
+        for (size_t position = _dequeue_position.load(std::memory_order_relaxed); position != end; ++position) {
+            _cells[position & _index_mask].GetValue()->~T();
+        }
+    }
+
+    static constexpr size_t capacity() {
+        return Capacity;
+    }
+
+    /// Returns false if the queue is full, value isn't moved in this case.
+    bool try_push(T&& value) {
+        return TryPush(std::move(value));
+    }
+
+    bool try_push(const T& value) {
+        T copy(value);
+        return TryPush(std::move(copy));
+    }
+
+    /// Blocks until there is a free cell: spins for a while, then sleeps until pop wakes it up.
+    void push_wait(T&& value) {
+        WaitFor(_push_event, [this, &value]() {
+            return TryPush(std::move(value));
+        }, std::nullopt);
+    }
+
+    void push_wait(const T& value) {
+        push_wait(T(value));
+    }
+
+    /// Same as push_wait, the bounded queue can't push without waiting for space.
+    void push(T&& value) {
+        push_wait(std::move(value));
+    }
+
+    void push(const T& value) {
+        push_wait(T(value));
+    }
+
+    /// Value is constructed before waiting and moved into the cell.
+    template<class... Args>
+    void emplace(Args&& ... args) {
+        push_wait(T(std::forward<Args>(args)...));
+    }
+
+    /// Value is moved to result.
+    bool pop(T& result) {
+        return PopWith([&result](T& value) {
+            result = std::move(value);
+        });
+    }
+
+    std::optional<T> try_pop() {
+        std::optional<T> result;
+        PopWith([&result](T& value) {
+            result.emplace(std::move(value));
+        });
+        return result;
+    }
+
+    /// Blocks until a value is popped: spins for a while, then sleeps until push wakes it up.
+    void pop_wait(T& result) {
+        WaitFor(_pop_event, [this, &result]() {
+            return pop(result);
+        }, std::nullopt);
+    }
+
+    /// Same as pop_wait, but gives up after timeout, returns false in this case.
+    template<class Rep, class Period>
+    bool pop_for(T& result, const std::chrono::duration<Rep, Period>& timeout) {
+        return WaitFor(_pop_event, [this, &result]() {
+            return pop(result);
+        }, std::chrono::steady_clock::now() + timeout);
+    }
+
+    [[nodiscard]] bool empty() {
+        size_t position = _dequeue_position.load(std::memory_order_acquire);
+        return _cells[position & _index_mask].sequence.load(std::memory_order_acquire) != position + 1;
+    }
+
+private:
+    static constexpr int _spin_iterations_before_wait = 64;
+
+    bool TryPush(T&& value) {
+        size_t position = _enqueue_position.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = _cells[position & _index_mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+
+            if (difference == 0) {
+                if (_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed,
+                                                            std::memory_order_relaxed)) {
+                    new(cell.storage) T(std::move(value));
+                    /// seq_cst pairs with the fence in EventCount::PrepareWait.
+                    cell.sequence.store(position + 1, std::memory_order_seq_cst);
+                    _pop_event.Notify(1);
+                    return true;
+                }
+            }
+            else if (difference < 0) {
+                /// the cell still holds the value of the previous lap.
+                return false;
+            }
+            else {
+                position = _enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template<class Consumer>
+    bool PopWith(Consumer consume) {
+        size_t position = _dequeue_position.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = _cells[position & _index_mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+
+            if (difference == 0) {
+                if (_dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed,
+                                                            std::memory_order_relaxed)) {
+                    T* value = cell.GetValue();
+                    consume(*value);
+                    value->~T();
+                    /// the cell is free for the push of the next lap.
+                    cell.sequence.store(position + Capacity, std::memory_order_seq_cst);
+                    _push_event.Notify(1);
+                    return true;
+                }
+            }
+            else if (difference < 0) {
+                /// the cell hasn't been filled in this lap yet.
+                return false;
+            }
+            else {
+                position = _dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template<class Operation>
+    bool WaitFor(EventCount& event, Operation try_operation,
+                 const std::optional<std::chrono::steady_clock::time_point>& deadline) {
+        for (int i = 0; i < _spin_iterations_before_wait; ++i) {
+            if (try_operation()) {
+                return true;
+            }
+            CpuRelax();
+        }
+
+        while (true) {
+            /// check after registration: either the other side sees the waiter, or this check sees its change.
+            uint32_t ticket = event.PrepareWait();
+            if (try_operation()) {
+                event.CancelWait();
+                return true;
+            }
+            if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+                event.CancelWait();
+                return false;
+            }
+            event.Wait(ticket, deadline);
+        }
+    }
+
+    std::unique_ptr<Cell[]> _cells;
+
+    /// producers and consumers write different positions, so they are in different cache lines.
+    alignas(_atomic_alignment) std::atomic<size_t> _enqueue_position{0};
+    alignas(_atomic_alignment) std::atomic<size_t> _dequeue_position{0};
+
+    /// consumers wait on _pop_event and producers wait on _push_event for a free cell.
+    alignas(_atomic_alignment) EventCount _pop_event;
+    alignas(_atomic_alignment) EventCount _push_event;
+};
 
-#ifndef MSQ_DEBUG
-#define MSQ_LOG_DEBUG(...)
-#else
-#define MSQ_LOG_DEBUG(...)          dummy_debug(__VA_ARGS__);
-#endif
+/// Elimination front end of Queue for mixed push/pop loads on a nearly empty queue: a pop which finds the queue empty
+/// waits for a while in a random slot of the elimination array, a push which finds a waiting pop there hands
+/// the value over without touching head and tail of the queue.
+/// FIFO order is kept: a push eliminates only when the queue is empty after it has claimed the waiting pop,
+/// so the pair can be linearized at that moment as a push immediately followed by the pop. If the queue isn't empty,
+/// the pop is released and the push goes to the queue. A pop which isn't served in time returns false, as empty.
+/// QueueType is msq::Queue, values in the slots are moved, so ValueType must be movable.
+/// A pop which has been claimed waits until the push has moved its value, it's the only blocking step.
+template<class QueueType, size_t Slots_Num = 16, size_t Alignment = Cache_Line_Size>
+class EliminationQueue {
+    static_assert(Slots_Num > 0, "Elimination array must have slots");
 
-template<class PtrType, size_t Max_Hazard_Pointers_Num, size_t Max_Threads_Num>
-class HazardPointerManager {
+    using T = typename QueueType::ValueType;
 
-public:
-    using ProtectedPtrType = PtrType;
+    static constexpr size_t _slot_alignment = Padded_Alignment<std::atomic<uint8_t>, Alignment>;
 
-    class InnerHazardPointer {
-    public:
-        std::atomic<bool> free{true};
-        std::atomic<ProtectedPtrType> ptr;
+    enum SlotState : uint8_t {
+        Slot_Free,
+        Slot_Waiting, /// a pop waits in the slot
+        Slot_Claimed, /// a push has claimed the waiting pop
+        Slot_Filled   /// the value is in the slot
     };
 
-    class DataTLS {
+    /// every slot is in its own cache line, so pairs in different slots don't contend.
+    class alignas(_slot_alignment) Slot {
     public:
-
-        ~DataTLS() {
-            MSQ_LOG_DEBUG("TLS destructed in thread ", std::this_thread::get_id());
+        T* GetValue() {
+            return std::launder(reinterpret_cast<T*>(storage));
         }
 
-        DataTLS(HazardPointerManager<PtrType, Max_Hazard_Pointers_Num, Max_Threads_Num>* manager_tls)
-                : _manager_tls(manager_tls) {
-            for (auto& _inner_hazard: _inner_hazard_ptr_array) {
-                _inner_hazard.free.store(true);
-            }
-            MSQ_LOG_DEBUG("DataTLS constructed in thread ", std::this_thread::get_id());
-        }
+        std::atomic<uint8_t> state{Slot_Free};
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
 
-        std::atomic<bool> free{false};
-        std::atomic<DataTLS*> next{nullptr};
+public:
+    using Statistic = msq::Statistic;
+
+    void push(const T& value) {
+        emplace(value);
+    }
 
+    void push(T&& value) {
+        emplace(std::move(value));
+    }
 
-        /// Allocate always happens from the same thread.
-        InnerHazardPointer* TryAllocateHazardPtr() {
-            if (_current_hazard_ptr_index >= Max_Hazard_Pointers_Num) {
-                return nullptr;
-            }
-            _inner_hazard_ptr_array[_current_hazard_ptr_index].free.store(false);
-            return &_inner_hazard_ptr_array[_current_hazard_ptr_index++];
+    template<class... Args>
+    void emplace(Args&& ... args) {
+        Slot& slot = _slots[GetSlotIndex()];
+
+        uint8_t waiting = Slot_Waiting;
+        if (slot.state.load(std::memory_order_relaxed) != Slot_Waiting ||
+            !slot.state.compare_exchange_strong(waiting, Slot_Claimed, std::memory_order_acquire,
+                                                std::memory_order_relaxed)) {
+            _queue.emplace(std::forward<Args>(args)...);
+            return;
         }
 
-        /// Deallocate always happens from the same thread.
-        void DeallocateHazardPtr(InnerHazardPointer* ptr) {
-            ptr->free.store(true);
+        /// the pop can't leave the claimed slot, so both operations are in progress while empty is checked.
+        if (!_queue.empty()) {
+            slot.state.store(Slot_Waiting, std::memory_order_relaxed);
+            _queue.emplace(std::forward<Args>(args)...);
+            return;
+        }
 
-            /// it's work because hazard pointers are creating and deleting in the same order.
-            --_current_hazard_ptr_index;
+        try {
+            new(slot.storage) T(std::forward<Args>(args)...);
         }
+        catch (...) {
+            slot.state.store(Slot_Waiting, std::memory_order_relaxed);
+            throw;
+        }
+        slot.state.store(Slot_Filled, std::memory_order_release);
+        _eliminated_pairs_number.Add(1);
+    }
 
-        bool TryAddRetiredPtr(ProtectedPtrType ptr) {
-            if (_current_retired_ptr_index == _max_retired_ptrs_num()) {
-                return false;
-            }
-            _retired_ptr_array[_current_retired_ptr_index++] = ptr;
+    /// Value is moved to result.
+    bool pop(T& result) {
+        if (_queue.pop(result)) {
             return true;
         }
+        return TryEliminate([&result](T& value) {
+            result = std::move(value);
+        });
+    }
 
-        void ClearRetiredPointers() {
-            _manager_tls->_clearing_call_number.fetch_add(1, std::memory_order_relaxed);
+    std::optional<T> try_pop() {
+        std::optional<T> result = _queue.try_pop();
+        if (!result) {
+            TryEliminate([&result](T& value) {
+                result.emplace(std::move(value));
+            });
+        }
+        return result;
+    }
 
-            std::unordered_set<ProtectedPtrType> used_hazard_pointers = _manager_tls->GetUsedHazardPointers();
-            std::array<ProtectedPtrType, _max_retired_ptrs_num()> new_array;
-            int new_index = 0;
-            for (int i = 0; i < _current_retired_ptr_index; ++i) {
-                if (used_hazard_pointers.find(_retired_ptr_array[i]) != used_hazard_pointers.end()) {
-                    new_array[new_index++] = _retired_ptr_array[i];
-                }
-                else {
-                    delete _retired_ptr_array[i];
-                }
-            }
-            _retired_ptr_array = new_array;
-            _current_retired_ptr_index = new_index;
+    [[nodiscard]] bool empty() {
+        return _queue.empty();
+    }
+
+    /// Statistic of the queue, eliminated pairs aren't counted in its push and pop numbers.
+    Statistic GetStatistic() {
+        Statistic statistic = _queue.GetStatistic();
+        statistic.eliminated_pairs_number = _eliminated_pairs_number.Load();
+        return statistic;
+    }
+
+private:
+    static constexpr int _elimination_spin_iterations = 128;
+
+    template<class Consumer>
+    bool TryEliminate(Consumer consume) {
+        Slot& slot = _slots[GetSlotIndex()];
+
+        uint8_t free = Slot_Free;
+        if (!slot.state.compare_exchange_strong(free, Slot_Waiting, std::memory_order_relaxed,
+                                                std::memory_order_relaxed)) {
+            return false;
         }
 
-        void ForceClearRetiredPointers() {
-            for (int i = 0; i < _current_retired_ptr_index; ++i) {
-                delete _retired_ptr_array[i];
+        for (int i = 0; i < _elimination_spin_iterations; ++i) {
+            if (slot.state.load(std::memory_order_acquire) == Slot_Filled) {
+                return Consume(slot, consume);
             }
+            CpuRelax();
         }
 
+        uint8_t waiting = Slot_Waiting;
+        if (slot.state.compare_exchange_strong(waiting, Slot_Free, std::memory_order_relaxed,
+                                               std::memory_order_relaxed)) {
+            return false;
+        }
 
-    private:
-        friend class HazardPointerManager<PtrType, Max_Hazard_Pointers_Num, Max_Threads_Num>;
+        /// a push has claimed the slot, it either fills it or gives it back.
+        while (true) {
+            uint8_t state = slot.state.load(std::memory_order_acquire);
+            if (state == Slot_Filled) {
+                return Consume(slot, consume);
+            }
+            waiting = Slot_Waiting;
+            if (state == Slot_Waiting &&
+                slot.state.compare_exchange_strong(waiting, Slot_Free, std::memory_order_relaxed,
+                                                   std::memory_order_relaxed)) {
+                return false;
+            }
+            CpuRelax();
+        }
+    }
 
-        HazardPointerManager<PtrType, Max_Hazard_Pointers_Num, Max_Threads_Num>* _manager_tls;
+    template<class Consumer>
+    bool Consume(Slot& slot, Consumer& consume) {
+        T* value = slot.GetValue();
+        consume(*value);
+        value->~T();
+        slot.state.store(Slot_Free, std::memory_order_release);
+        return true;
+    }
 
-        static constexpr int _max_hazard_ptrs_num() {
-            return Max_Hazard_Pointers_Num;
-        }
+    /// every thread walks the slots in its own pseudo-random order, so collisions are spread over the array.
+    static size_t GetSlotIndex() {
+        static thread_local uint32_t random_state =
+                static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1u;
 
-        static constexpr int _max_retired_ptrs_num() {
-            return Max_Hazard_Pointers_Num * Max_Threads_Num;
-        }
+        /// xorshift32
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state % Slots_Num;
+    }
 
-        std::array<InnerHazardPointer, Max_Hazard_Pointers_Num> _inner_hazard_ptr_array;
-        std::atomic<int> _current_hazard_ptr_index{0};
+    QueueType _queue;
 
+    std::array<Slot, Slots_Num> _slots;
 
-        std::array<ProtectedPtrType, _max_retired_ptrs_num()> _retired_ptr_array;
-        int _current_retired_ptr_index = 0;
-    };
+    SharedCounter<Alignment> _eliminated_pairs_number;
+};
 
-private:
-    class ReleaserTLS {
-    public:
-        ReleaserTLS(const std::shared_ptr<bool>& is_manager_destructed)
-                : _is_manager_destructed(is_manager_destructed) {}
+/// Number of NUMA nodes from /sys/devices/system/node/online, 1 if it isn't available or on other platforms.
+inline size_t GetNumaNodesNumber() {
+#ifndef __linux__
+    return 1;
+#else
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string nodes;
+    if (!std::getline(online, nodes)) {
+        return 1;
+    }
 
-        void SetTLS(DataTLS* tls) {
-            _tls = tls;
+    /// the list is like "0-1" or "0,2-3", the last node is the largest one.
+    size_t last_node = 0;
+    size_t number = 0;
+    bool has_digits = false;
+    for (char c: nodes) {
+        if (c >= '0' && c <= '9') {
+            number = number * 10 + static_cast<size_t>(c - '0');
+            has_digits = true;
         }
-
-        ~ReleaserTLS() {
-            if (!*_is_manager_destructed) {
-                _tls->free.store(true, std::memory_order_relaxed);
-            }
+        else {
+            last_node = has_digits ? number : last_node;
+            number = 0;
+            has_digits = false;
         }
+    }
+    last_node = has_digits ? number : last_node;
+    return last_node + 1;
+#endif
+}
 
-    private:
-        DataTLS* _tls;
+/// Sharded front end of Queue for multi-socket machines: every shard is its own QueueType, so head and tail of
+/// a shard are touched only by the threads of its NUMA node, or of its cpu group if the shards number isn't
+/// the NUMA nodes number (cpus are split into equal groups by their numbers).
+/// push enqueues to the home shard of the calling thread, pop drains the home shard first and then steals
+/// from the next shards in order. push_to/pop_from take the home shard from the caller, e.g. from a worker
+/// which is pinned to a node.
+/// Ordering is relaxed: every shard is FIFO, so values which a thread pushes to the same shard are popped in
+/// the push order, values of different shards (and of a thread which has migrated to another node between
+/// pushes) aren't ordered. A pop returns false when every shard was empty at the moment it was checked,
+/// a value pushed to an already checked shard during the pop can be missed.
+template<class QueueType, size_t Alignment = Cache_Line_Size>
+class ShardedQueue {
+    using T = typename QueueType::ValueType;
 
-        /// Note:
-        /// according https://en.cppreference.com/w/cpp/language/storage_duration thread storage duration:
-        /// "The storage for the object is allocated when the thread begins and deallocated when the thread ends.
-        /// Each thread has its own instance of the object."
-        /// But on MacOS I've got address sanitizer error that ReleaserTLS which was constructed not in main thread
-        /// was destructed in main thread after all other threads and HazardPointerManager destructions,
-        /// so this flag fixed the compiler non-compliance with the C++ standard on MacOS.
-        std::shared_ptr<bool> _is_manager_destructed;
+    class alignas(Padded_Alignment<QueueType, Alignment>) Shard {
+    public:
+        QueueType queue;
     };
 
 public:
-    HazardPointerManager(std::atomic<size_t>& clearing_call_number)
-            : _clearing_call_number(clearing_call_number),
-              _is_destructed(std::make_shared<bool>(false)) {}
+    using Statistic = msq::Statistic;
 
-    ~HazardPointerManager() {
-        *_is_destructed = true;
-        DataTLS* current = _head_tls.load();
+    explicit ShardedQueue(size_t shards_num = GetNumaNodesNumber())
+            : _shards_num(std::max<size_t>(shards_num, 1)),
+              _numa_nodes_num(GetNumaNodesNumber()),
+              _cpus_num(std::max<size_t>(std::thread::hardware_concurrency(), 1)),
+              _shards(new Shard[_shards_num]) {}
 
-        while (current != nullptr) {
-            DataTLS* next = current->next.load();
-            current->ForceClearRetiredPointers();
-            delete current;
-            current = next;
-        }
-        MSQ_LOG_DEBUG("HazardPointerManager destructed in thread ", std::this_thread::get_id());
+    void push(const T& value) {
+        emplace_to(GetHomeShard(), value);
     }
 
-    DataTLS* GetTLS() {
-        static thread_local DataTLS* tls = nullptr;
+    void push(T&& value) {
+        emplace_to(GetHomeShard(), std::move(value));
+    }
 
-        if (tls != nullptr) {
-            return tls;
-        }
+    template<class... Args>
+    void emplace(Args&& ... args) {
+        emplace_to(GetHomeShard(), std::forward<Args>(args)...);
+    }
 
-        /// if thread finished ReleaserTLS will clear it TLS using destructor
-        static thread_local ReleaserTLS releaser(_is_destructed);
+    /// Value is moved to result.
+    bool pop(T& result) {
+        return pop_from(GetHomeShard(), result);
+    }
 
-        /// if released tls exist - return it.
-        for (DataTLS* current = _head_tls.load(); current != nullptr; current = current->next.load()) {
-            bool true_cas = true;
-            if (current->free.compare_exchange_strong(true_cas, false)) {
-                releaser.SetTLS(current);
-                tls = current;
-                return tls;
-            }
-        }
+    std::optional<T> try_pop() {
+        return try_pop_from(GetHomeShard());
+    }
 
-        tls = new DataTLS(this);
-        releaser.SetTLS(tls);
-        while (true) {
-            DataTLS* head = _head_tls.load();
-            tls->next = head;
-            if (_head_tls.compare_exchange_strong(head, tls)) {
-                return tls;
-            }
-        }
+    void push_to(size_t shard, const T& value) {
+        emplace_to(shard, value);
     }
 
-    std::unordered_set<ProtectedPtrType> GetUsedHazardPointers() {
-        DataTLS* head = _head_tls.load(std::memory_order_acquire);
+    void push_to(size_t shard, T&& value) {
+        emplace_to(shard, std::move(value));
+    }
 
-        std::unordered_set<ProtectedPtrType> res;
-        while (head != nullptr) {
-            if (head->free.load(std::memory_order_relaxed)) {
-                head = head->next.load(std::memory_order_acquire);
-                continue;
-            }
+    template<class... Args>
+    void emplace_to(size_t shard, Args&& ... args) {
+        _shards[shard % _shards_num].queue.emplace(std::forward<Args>(args)...);
+    }
 
-            for (int i = 0; i < head->_max_hazard_ptrs_num(); ++i) {
-                if (!head->_inner_hazard_ptr_array[i].free.load()) {
-                    res.emplace(head->_inner_hazard_ptr_array[i].ptr.load());
-                }
+    bool pop_from(size_t shard, T& result) {
+        return PopWith(shard, [&result](QueueType& queue) {
+            return queue.pop(result);
+        });
+    }
+
+    std::optional<T> try_pop_from(size_t shard) {
+        std::optional<T> result;
+        PopWith(shard, [&result](QueueType& queue) {
+            result = queue.try_pop();
+            return result.has_value();
+        });
+        return result;
+    }
+
+    /// Shards are checked one by one, so it isn't atomic over the shards.
+    [[nodiscard]] bool empty() {
+        for (size_t i = 0; i < _shards_num; ++i) {
+            if (!_shards[i].queue.empty()) {
+                return false;
             }
-            head = head->next.load(std::memory_order_acquire);
         }
-        return res;
+        return true;
     }
 
-private:
-    std::atomic<DataTLS*> _head_tls{nullptr};
-
-    std::atomic<size_t>& _clearing_call_number;
+    [[nodiscard]] size_t shards_num() const {
+        return _shards_num;
+    }
 
-    std::shared_ptr<bool> _is_destructed;
-};
+    /// Sum of the shards statistic, a pop which steals counts empty pops of the shards it has passed.
+    Statistic GetStatistic() {
+        Statistic statistic;
+        for (size_t i = 0; i < _shards_num; ++i) {
+            AddStatistic(statistic, _shards[i].queue.GetStatistic());
+        }
+        statistic.stolen_pops_number = _stolen_pops_number.Load();
+        return statistic;
+    }
 
-template<class Manager>
-class HazardPointer {
-    using TLS = typename Manager::DataTLS;
-    using ProtectedPtrType = typename Manager::ProtectedPtrType;
-    using InnerHazardPtr = typename Manager::InnerHazardPointer;
+private:
+    /// the cpu of a thread is checked once in this number of operations, the thread can migrate between checks.
+    static constexpr uint32_t _cpu_refresh_period = 256;
 
-public:
-    HazardPointer(Manager* manager_tls)
-            : _tls(manager_tls->GetTLS()) {
-        _inner_hazard_pointer = _tls->TryAllocateHazardPtr();
-        if (_inner_hazard_pointer == nullptr) {
-            throw std::logic_error(
-                    "Can't allocate new hazard pointer, probably the limit of hazard pointer number has been exceeded");
+    template<class TryPop>
+    bool PopWith(size_t shard, TryPop try_pop) {
+        shard %= _shards_num;
+        if (try_pop(_shards[shard].queue)) {
+            return true;
+        }
+        for (size_t i = 1; i < _shards_num; ++i) {
+            if (try_pop(_shards[(shard + i) % _shards_num].queue)) {
+                _stolen_pops_number.Add(1);
+                return true;
+            }
         }
+        return false;
     }
 
-    ~HazardPointer() {
-        _tls->DeallocateHazardPtr(_inner_hazard_pointer);
-    }
+    /// on other platforms than Linux every thread is on cpu 0 of node 0, so its home shard is 0.
+    size_t GetHomeShard() const {
+        static thread_local unsigned cpu = 0;
+        static thread_local unsigned node = 0;
+        static thread_local uint32_t operations_before_refresh = 0;
 
-    void Retire() {
-        if (!_tls->TryAddRetiredPtr(_inner_hazard_pointer->ptr)) {
-            _tls->ClearRetiredPointers();
-            if (!_tls->TryAddRetiredPtr(_inner_hazard_pointer->ptr)) {
-                throw std::logic_error("Still there is no space for retired_ptr, after clearing");
-            }
+        if (operations_before_refresh == 0) {
+#ifdef __linux__
+            syscall(SYS_getcpu, &cpu, &node, nullptr);
+#endif
+            operations_before_refresh = _cpu_refresh_period;
         }
+        --operations_before_refresh;
+
+        if (_shards_num == _numa_nodes_num) {
+            return node % _shards_num;
+        }
+        return std::min<size_t>(cpu * _shards_num / _cpus_num, _shards_num - 1);
     }
 
-    ProtectedPtrType Protect(const std::atomic<ProtectedPtrType>& ptr) {
-        /// This construction is important because we can sleep on first ptr.load() and during this sleep
-        /// clearing function can start and delete ptr that we loaded.
-        while (true) {
-            _inner_hazard_pointer->ptr = ptr.load(std::memory_order_acquire);
-            if (_inner_hazard_pointer->ptr == ptr.load(std::memory_order_acquire)) {
-                return _inner_hazard_pointer->ptr;
-            }
+    static void AddStatistic(Statistic& sum, const Statistic& statistic) {
+        sum.constructed_nodes_number += statistic.constructed_nodes_number;
+        sum.destructed_nodes_number += statistic.destructed_nodes_number;
+        sum.loop_iterations_number_in_push += statistic.loop_iterations_number_in_push;
+        sum.successful_push_number += statistic.successful_push_number;
+        sum.loop_iterations_number_in_pop += statistic.loop_iterations_number_in_pop;
+        sum.successful_pop_number += statistic.successful_pop_number;
+        sum.empty_pop_number += statistic.empty_pop_number;
+        sum.clearing_function_call_number += statistic.clearing_function_call_number;
+        sum.pool_hit_number += statistic.pool_hit_number;
+        sum.pool_miss_number += statistic.pool_miss_number;
+        sum.eliminated_pairs_number += statistic.eliminated_pairs_number;
+        sum.max_reclamation_pause_ns = std::max(sum.max_reclamation_pause_ns, statistic.max_reclamation_pause_ns);
+        for (size_t i = 0; i < Retries_Histogram_Size; ++i) {
+            sum.push_retries_histogram[i] += statistic.push_retries_histogram[i];
+            sum.pop_retries_histogram[i] += statistic.pop_retries_histogram[i];
         }
     }
 
-private:
-    TLS* _tls;
-    InnerHazardPtr* _inner_hazard_pointer;
+    const size_t _shards_num;
+    const size_t _numa_nodes_num;
+    const size_t _cpus_num;
+
+    std::unique_ptr<Shard[]> _shards;
+
+    SharedCounter<Alignment> _stolen_pops_number;
 };
 
-template<class T, size_t Max_Threads_Num>
-class Queue {
+/// Priority queue of Lanes_Num Michael-Scott lanes, lane 0 has the highest priority: pop takes a value of the
+/// highest non-empty lane, so control messages overtake bulk data. Lanes share one reclamation manager, allocator
+/// and statistic, a pop takes its hazard pointers once for all lanes it tries.
+/// The mask of non-empty lanes lets pop go straight to the lane: push sets the bit of its lane after linking
+/// the node, a pop which finds the lane empty clears the bit and checks the lane again, setting the bit back
+/// if a value has been pushed meanwhile, so a non-empty lane always gets its bit.
+/// Every lane is FIFO, values of different lanes are ordered only by priority. A pop can return false if
+/// the only non-empty lane has its bit cleared for a moment by another pop, as for a push which isn't finished.
+/// Template parameters after Lanes_Num are the same as in Queue.
+template<class T, size_t Lanes_Num, size_t Max_Threads_Num, template<class> class NodeAllocator = NodePool,
+        size_t Alignment = Cache_Line_Size, class Stats = SharedStats<Alignment>,
+        template<class, size_t, size_t, class, class, size_t> class Reclamation = HazardPointerManager,
+        class Backoff = NoBackoff>
+class MultiLaneQueue {
+    static_assert(Lanes_Num > 0 && Lanes_Num <= 64, "Non-empty lanes mask has 64 bits");
+
+    static constexpr size_t _atomic_alignment = Padded_Alignment<std::atomic<size_t>, Alignment>;
+
 public:
-    class Statistic {
-    public:
-        ~Statistic() {
-            MSQ_LOG_DEBUG("Statistic destructed in thread ", std::this_thread::get_id());
-        }
-
-        std::atomic<size_t> constructed_nodes_number{0};
-        std::atomic<size_t> destructed_nodes_number{0};
-        std::atomic<size_t> loop_iterations_number_in_push{0};
-        std::atomic<size_t> successful_push_number{0};
-        std::atomic<size_t> loop_iterations_number_in_pop{0};
-        std::atomic<size_t> successful_pop_number{0};
-        std::atomic<size_t> empty_pop_number{0};
-        std::atomic<size_t> clearing_function_call_number{0};
-    };
+    using ValueType = T;
+    using Statistic = msq::Statistic;
 
 private:
     class Node {
     public:
-        Node(Node* next, T value, Statistic& statistic) : next(next), value(value), _statistic(statistic) {
-            _statistic.constructed_nodes_number.fetch_add(1, std::memory_order_relaxed);
-        }
+        template<class... Args>
+        Node(Node* next, std::in_place_t, Args&& ... args) : next(next), value(std::forward<Args>(args)...) {}
 
-        Node(Node* next, Statistic& statistic) : next(next), _statistic(statistic) {
-            _statistic.constructed_nodes_number.fetch_add(1, std::memory_order_relaxed);
-        }
+        explicit Node(Node* next) : next(next) {}
 
-        ~Node() {
-            _statistic.destructed_nodes_number.fetch_add(1, std::memory_order_relaxed);
-        }
+        /// value is destroyed by the popping thread or in ~MultiLaneQueue, as in Queue.
+        ~Node() {}
 
         std::atomic<Node*> next;
 
-        /// hack for creation sentinel node if user type doesn't have default constructor
         union {
             T value;
         };
-
-    private:
-        Statistic& _statistic;
     };
 
-    using ManagerHP = HazardPointerManager<Node*, 3, Max_Threads_Num>;
-    using HazardPtr = HazardPointer<ManagerHP>;
+    /// consumers write head and producers write tail, so they are in different cache lines.
+    class Lane {
+    public:
+        alignas(_atomic_alignment) std::atomic<Node*> head_ref{nullptr};
+        alignas(_atomic_alignment) std::atomic<Node*> tail_ref{nullptr};
+    };
 
-    std::atomic<Node*> _head_ref{new Node(nullptr, _statistic)};
-    std::atomic<Node*> _tail_ref{_head_ref.load(std::memory_order_relaxed)};
+    using Allocator = NodeAllocator<Node>;
+    /// pop needs 3 hazard pointers: head, head next and tail.
+    using Reclaimer = Reclamation<Node*, 3, Max_Threads_Num, Allocator, Stats, Alignment>;
+    using HazardPtr = typename Reclaimer::Guard;
 
 public:
-    Queue() : _hazard_manager(_statistic.clearing_function_call_number) {}
+    MultiLaneQueue() : _reclaimer(_allocator, _stats) {
+        auto* tls = _reclaimer.GetTLS();
+        for (Lane& lane: _lanes) {
+            Node* sentinel = _allocator.New(tls->GetAllocatorCache(), tls->GetCounters(), nullptr);
+            lane.head_ref.store(sentinel, std::memory_order_relaxed);
+            lane.tail_ref.store(sentinel, std::memory_order_relaxed);
+        }
+        tls->GetCounters().constructed_nodes_number.Add(Lanes_Num);
+    }
 
-    ~Queue() {
-        MSQ_LOG_DEBUG("Queue destructed in thread ", std::this_thread::get_id());
+    ~MultiLaneQueue() {
+        MSQ_LOG_DEBUG("MultiLaneQueue destructed in thread ", std::this_thread::get_id());
 
         /// queue must be destroyed in one thread when others have finished working with it.
-        Node* current = _head_ref.load(std::memory_order_relaxed);
-        while (current != nullptr) {
-            Node* next = current->next.load(std::memory_order_relaxed);
-            delete current;
-            current = next;
+        for (Lane& lane: _lanes) {
+            Node* current = lane.head_ref.load(std::memory_order_relaxed);
+            bool is_sentinel = true;
+            while (current != nullptr) {
+                Node* next = current->next.load(std::memory_order_relaxed);
+                if (!is_sentinel) {
+                    current->value.~T();
+                }
+                is_sentinel = false;
+                _allocator.Delete(current);
+                current = next;
+            }
+        }
+    }
+
+    /// lane < Lanes_Num, it's checked only in debug builds.
+    void push(size_t lane, const T& value) {
+        emplace(lane, value);
+    }
+
+    void push(size_t lane, T&& value) {
+        emplace(lane, std::move(value));
+    }
+
+    /// lane < Lanes_Num, it's checked only in debug builds.
+    template<class... Args>
+    void emplace(size_t lane, Args&& ... args) {
+        assert(lane < Lanes_Num && "MultiLaneQueue lane is out of range");
+        HazardPtr hazard_pointer = HazardPtr(&_reclaimer);
+        Emplace(hazard_pointer, lane, std::forward<Args>(args)...);
+    }
+
+    /// Value of the highest non-empty lane is moved to result.
+    bool pop(T& result) {
+        return PopWith([&result](T& value) {
+            result = std::move(value);
+        });
+    }
+
+    std::optional<T> try_pop() {
+        std::optional<T> result;
+        PopWith([&result](T& value) {
+            result.emplace(std::move(value));
+        });
+        return result;
+    }
+
+    /// Checks only the lanes of the non-empty lanes mask, a lane in the middle of push or pop can be missed.
+    /// The bit of a lane stays set after its last value is popped until a pop finds it empty, so the lane
+    /// itself is checked.
+    [[nodiscard]] bool empty() {
+        uint64_t non_empty_lanes = _non_empty_lanes.load(std::memory_order_seq_cst);
+        if (non_empty_lanes == 0) {
+            return true;
+        }
+
+        HazardPtr hp_head = HazardPtr(&_reclaimer);
+        while (non_empty_lanes != 0) {
+            auto lane_index = static_cast<size_t>(__builtin_ctzll(non_empty_lanes));
+            if (!IsEmpty(_lanes[lane_index], hp_head)) {
+                return false;
+            }
+            non_empty_lanes &= non_empty_lanes - 1;
         }
+        return true;
     }
 
-    void push(T value) {
+    /// With ThreadLocalStats counters are summed up on every call, so it's intended for rare metric export.
+    Statistic GetStatistic() {
+        return _stats.Collect(_reclaimer);
+    }
+
+private:
+    template<class... Args>
+    void Emplace(HazardPtr& hazard_pointer, size_t lane_index, Args&& ... args) {
+        MSQ_TRACE_START(trace_start);
         int loop_times_before_success = 0;
+        Backoff backoff;
 
-        Node* new_node = new Node(nullptr, value, _statistic);
-        HazardPtr hazard_pointer = HazardPtr(&_hazard_manager);
+        Lane& lane = _lanes[lane_index];
+        auto& counters = hazard_pointer.GetTLS()->GetCounters();
+        Node* new_node = _allocator.New(hazard_pointer.GetTLS()->GetAllocatorCache(), counters, nullptr,
+                                        std::in_place, std::forward<Args>(args)...);
+        counters.constructed_nodes_number.Add(1);
 
         while (true) {
             ++loop_times_before_success;
 
-            Node* tail = hazard_pointer.Protect(_tail_ref);
-            Node* tail_next = tail->next.load(
-                    std::memory_order_acquire); /// tail_next can't change if tail hasn't changed, so we shouldn't protect it
+            Node* tail = hazard_pointer.Protect(lane.tail_ref);
+            Node* tail_next = tail->next.load(std::memory_order_acquire);
 
             Node* cas_nullptr = nullptr;
             if (tail_next != nullptr) {
-                _tail_ref.compare_exchange_weak(tail, tail_next, std::memory_order_release, std::memory_order_relaxed);
+                lane.tail_ref.compare_exchange_weak(tail, tail_next, std::memory_order_release,
+                                                    std::memory_order_relaxed);
             }
-            else if (tail->next.compare_exchange_strong(cas_nullptr, new_node, std::memory_order_release,
+            /// seq_cst orders the link before the mask update, a pop which clears the bit sees the node.
+            else if (tail->next.compare_exchange_strong(cas_nullptr, new_node, std::memory_order_seq_cst,
                                                         std::memory_order_relaxed)) {
-                _tail_ref.compare_exchange_weak(tail, new_node, std::memory_order_release, std::memory_order_relaxed);
+                lane.tail_ref.compare_exchange_weak(tail, new_node, std::memory_order_release,
+                                                    std::memory_order_relaxed);
+                SetNonEmpty(lane_index);
 
-                _statistic.loop_iterations_number_in_push.fetch_add(loop_times_before_success,
-                                                                    std::memory_order_relaxed);
-                _statistic.successful_push_number.fetch_add(1, std::memory_order_relaxed);
+                counters.AddPushLoopIterations(loop_times_before_success);
+                counters.successful_push_number.Add(1);
+                MSQ_TRACE_EVENT(Trace_Push, trace_start, loop_times_before_success);
                 return;
             }
+            else {
+                MSQ_TRACE_EVENT(Trace_Push_Cas_Failure, trace_start, loop_times_before_success);
+                backoff.Fail();
+            }
         }
     }
 
-    bool pop(T& result) {
+    template<class Consumer>
+    bool PopWith(Consumer consume) {
+        uint64_t non_empty_lanes = _non_empty_lanes.load(std::memory_order_seq_cst);
+        if (non_empty_lanes == 0) {
+            return false;
+        }
+
+        HazardPtr hp_head = HazardPtr(&_reclaimer);
+        HazardPtr hp_head_next = HazardPtr(&_reclaimer);
+        HazardPtr hp_tail = HazardPtr(&_reclaimer);
+        while (non_empty_lanes != 0) {
+            auto lane_index = static_cast<size_t>(__builtin_ctzll(non_empty_lanes));
+            if (Pop(_lanes[lane_index], hp_head, hp_head_next, hp_tail, consume)) {
+                return true;
+            }
+
+            uint64_t bit = uint64_t{1} << lane_index;
+            _non_empty_lanes.fetch_and(~bit, std::memory_order_seq_cst);
+            if (!IsEmpty(_lanes[lane_index], hp_head)) {
+                SetNonEmpty(lane_index);
+            }
+            non_empty_lanes = _non_empty_lanes.load(std::memory_order_seq_cst);
+        }
+        return false;
+    }
+
+    /// The same as Queue::Pop on one lane.
+    template<class Consumer>
+    bool Pop(Lane& lane, HazardPtr& hp_head, HazardPtr& hp_head_next, HazardPtr& hp_tail, Consumer& consume) {
+        MSQ_TRACE_START(trace_start);
         int loop_times_before_success = 0;
+        Backoff backoff;
 
-        HazardPtr hp_head = HazardPtr(&_hazard_manager);      /// for safe "_head_ref.compare_exchange(head, head_next)"
-        HazardPtr hp_head_next = HazardPtr(&_hazard_manager); /// for safe "result = head_next->value;"
-        HazardPtr hp_tail = HazardPtr(&_hazard_manager);      /// for safe "_tail_ref.compare_exchange(tail, head_next)"
+        auto& counters = hp_head.GetTLS()->GetCounters();
 
         while (true) {
             ++loop_times_before_success;
 
-            Node* head = hp_head.Protect(_head_ref);
-            Node* tail = hp_tail.Protect(_tail_ref);
+            Node* head = hp_head.Protect(lane.head_ref);
+            Node* tail = hp_tail.Protect(lane.tail_ref);
             Node* head_next = hp_head_next.Protect(head->next);
 
             if (head == tail) {
                 if (head_next == nullptr) {
-                    _statistic.empty_pop_number.fetch_add(1, std::memory_order_relaxed);
+                    counters.empty_pop_number.Add(1);
+                    MSQ_TRACE_EVENT(Trace_Empty_Pop, trace_start, loop_times_before_success);
                     return false;
                 }
-                _tail_ref.compare_exchange_weak(tail, head_next, std::memory_order_release, std::memory_order_relaxed);
+                lane.tail_ref.compare_exchange_weak(tail, head_next, std::memory_order_release,
+                                                    std::memory_order_relaxed);
             }
             else {
-                if (_head_ref.compare_exchange_strong(head, head_next, std::memory_order_release,
-                                                      std::memory_order_relaxed)) {
-                    result = head_next->value;
+                if (lane.head_ref.compare_exchange_strong(head, head_next, std::memory_order_release,
+                                                          std::memory_order_relaxed)) {
+                    consume(head_next->value);
+                    head_next->value.~T();
 
                     hp_head.Retire();
 
-                    _statistic.loop_iterations_number_in_pop.fetch_add(loop_times_before_success,
-                                                                       std::memory_order_relaxed);
-                    _statistic.successful_pop_number.fetch_add(1, std::memory_order_relaxed);
+                    counters.AddPopLoopIterations(loop_times_before_success);
+                    counters.successful_pop_number.Add(1);
+                    MSQ_TRACE_EVENT(Trace_Pop, trace_start, loop_times_before_success);
                     return true;
                 }
+                MSQ_TRACE_EVENT(Trace_Pop_Cas_Failure, trace_start, loop_times_before_success);
+                backoff.Fail();
             }
         }
     }
 
-    [[nodiscard]] bool empty() {
-        HazardPtr hp_head(&_hazard_manager);
-        Node* head = hp_head.Protect(_head_ref);
-
-        return head->next.load(std::memory_order_acquire) == nullptr;
+    static bool IsEmpty(Lane& lane, HazardPtr& hp_head) {
+        Node* head = hp_head.Protect(lane.head_ref);
+        return head->next.load(std::memory_order_seq_cst) == nullptr;
     }
 
-    const Statistic& GetStatistic() {
-        return _statistic;
+    /// the bit is usually set already, so a plain load saves the RMW on the shared mask.
+    void SetNonEmpty(size_t lane_index) {
+        uint64_t bit = uint64_t{1} << lane_index;
+        if ((_non_empty_lanes.load(std::memory_order_seq_cst) & bit) == 0) {
+            _non_empty_lanes.fetch_or(bit, std::memory_order_seq_cst);
+        }
     }
 
-private:
-    Statistic _statistic;
-    ManagerHP _hazard_manager;
+    Stats _stats;
+    Allocator _allocator;
+    Reclaimer _reclaimer;
+
+    std::array<Lane, Lanes_Num> _lanes;
+
+    /// bit i is set when lane i may have values.
+    alignas(_atomic_alignment) std::atomic<uint64_t> _non_empty_lanes{0};
 };
 
 }
\ No newline at end of file